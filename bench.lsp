@@ -0,0 +1,12 @@
+; JIT 基准: 对比
+;   time ./lispy < bench.lsp
+;   time ./lispy --no-jit < bench.lsp
+(load "lispy.lsp")
+
+; 非尾递归, 调用自己
+(fun {fib2 n} {if (< n 2) {n} {+ (fib2 (- n 1)) (fib2 (- n 2))}})
+(fib2 27)
+
+; 尾递归循环
+(fun {loop n acc} {if (== n 0) {acc} {loop (- n 1) (+ acc (* n 3))}})
+(loop 3000000 0)
@@ -7,6 +7,10 @@
 (def {fun} (\ {f b} {
     def (head f) (\ (tail f) b)
 }))
+; Function Definitions with Cached Results
+(fun {memo-fun f b} {
+    def (head f) (memo (\ (tail f) b))
+})
 ; Unpack List for Function
 (fun {unpack f l} {
     eval (join (list f) l)
@@ -43,7 +47,7 @@
 (fun {trd l} { eval (head (tail (tail l))) })
 ; List Length
 (fun {len l} {
-    if (== 1 nil)
+    if (== l nil)
         {0}
         {+ 1 (len (tail l))}
 })
@@ -67,7 +71,7 @@
         {drop (- n 1) (tail l)}
 })
 ; Split at N
-(fun {split n l} {list (tak n l) (drop n l)})
+(fun {split n l} {list (take n l) (drop n l)})
 ; Element of List
 (fun {elem x l} {
     if (== l nil)
@@ -90,7 +94,7 @@
 })
 ; Fold Left
 (fun {foldl f z l} {
-    if (== 1 nil)
+    if (== l nil)
         {z}
         {foldl f (f z (fst l)) (tail l)}
 })
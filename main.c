@@ -1,4 +1,17 @@
 #include "mpc.h"
+#include <limits.h>
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) && !defined(__WIN32)
+#include <sys/mman.h>
+#define LJIT // 热点 lambda 编译成机器码, 见 ljit_call
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define LVEC_AVX2 // 向量运算的 AVX2 版本, 运行时按 CPU 选, 见 lvec_simd
+#endif
 
 int strlength(char *s)
 {
@@ -11,7 +24,8 @@ static char buffer[BUFFER_LENGTH];
 char *readline(char *prompt)
 {
   fputs(prompt, stdout);
-  fgets(buffer, BUFFER_LENGTH, stdin);
+  if (fgets(buffer, BUFFER_LENGTH, stdin) == NULL)
+    return NULL;
   char *cpy = malloc(strlength(buffer));
   strcpy(cpy, buffer);
   cpy[strlen(cpy) - 1] = '\0';
@@ -23,6 +37,7 @@ void add_history(char *input) {}
 #endif
 
 mpc_parser_t *Number;
+mpc_parser_t *Double;
 mpc_parser_t *Symbol;
 mpc_parser_t *String;
 mpc_parser_t *Comment;
@@ -35,11 +50,15 @@ enum
 {
   LVAL_ERR,
   LVAL_NUM,
+  LVAL_DBL,
   LVAL_SYM,
   LVAL_STR,
   LVAL_SEXPR,
   LVAL_QEXPR,
-  LVAL_FUN
+  LVAL_FUN,
+  LVAL_MEMO, // (memo f) 返回的带缓存的函数, 见 lmemo_call
+  LVAL_VEC,  // (vec 1 2 3) 返回的数值向量, 见 lvec
+  LVAL_MAT   // (mat {{1 2} {3 4}}) 返回的矩阵, 也用 lvec 存, 按行排列
 };
 char *ltype_name(int type)
 {
@@ -49,6 +68,8 @@ char *ltype_name(int type)
     return "<error>";
   case LVAL_NUM:
     return "<number>";
+  case LVAL_DBL:
+    return "<double>";
   case LVAL_SYM:
     return "<symbol>";
   case LVAL_STR:
@@ -57,6 +78,12 @@ char *ltype_name(int type)
     return "<sexpr>";
   case LVAL_QEXPR:
     return "<qexpr>";
+  case LVAL_MEMO:
+    return "<memo>";
+  case LVAL_VEC:
+    return "<vector>";
+  case LVAL_MAT:
+    return "<matrix>";
   default:
     return "<Unbound function!>";
   }
@@ -65,33 +92,494 @@ struct lval;
 struct lenv;
 typedef struct lval lval;
 typedef struct lenv lenv;
+typedef struct lbuf lbuf;
+typedef struct lstr lstr;
+typedef struct lcode lcode;
+typedef struct ljit ljit;
+typedef struct lmemo lmemo;
+typedef struct lbig lbig;
+typedef struct lvec lvec;
+// 刚好占满 lambda 那几个指针的位置, 不让 lval 变大
+#define LVAL_SSO 20
 typedef lval *(*lbuildin)(lenv *e, lval *v);
+typedef lval *(*lbinop)(lval *a, lval *b);
 
+// 各类型只用到自己的字段, 所以放进 union, 按 type 区分
+// 小整数和大部分浮点数不分配内存, 直接编码在指针里, 见 LVAL_IS_IMM
+// 其余的值带引用计数, 可以被多处共享, 修改之前要先 lval_own
 struct lval
 {
   int type;
+  int rc;
 
-  long num;
-  char *err;
-  char *sym;
-  char *str;
-  //    lbuildin fun;
-  lbuildin buildin;
+  union
+  {
+    // 只有超出立即数范围的整数才会用到; 超出 long 的用 big (这时 num 是同号的 LONG_MAX / LONG_MIN)
+    struct
+    {
+      long num;
+      lbig *big;
+    };
+    double dbl; // 编码不进指针的浮点数, 见 ldbl_imm
+    char *err;
+    int sym; // 符号表里的编号, 见 lsym_intern
+    // 短字符串直接放在 sso 里, 长的放在共享只读的 lstr 里
+    // str 总是指向以 '\0' 结尾的内容, len 不含结尾的 '\0'
+    struct
+    {
+      char *str;
+      int len;
+      char sso[LVAL_SSO];
+    };
+    struct
+    {
+      lbuildin buildin;
+      union
+      {
+        lenv *env;     // lambda: 部分应用时捕获的参数
+        lbinop binop;  // 内建函数: 两个参数时的快速版本, 可以为 NULL
+      };
+      lval *formals;
+      lval *body;
+    };
+    // 元素放在可以共享的 lbuf 里, cell 指向本列表的第一个元素
+    // tail / 拷贝只是同一个 lbuf 上的另一段视图, 不复制元素
+    // code 是编译好的字节码, 拷贝时共享, 元素有任何改动就丢掉
+    struct
+    {
+      int count;
+      lval **cell;
+      lbuf *buf;
+      lcode *code;
+    };
+    lmemo *memo; // 拷贝时共享
+    lvec *vec;   // 向量和矩阵, 拷贝时共享
+  };
+};
 
-  lenv *env;
-  lval *formals;
-  lval *body;
+// 指针最低位为 1 是小整数, 最低两位为 10 是浮点数, 都不是才是真的指针
+const int limm_type[4] = {0, LVAL_NUM, LVAL_DBL, LVAL_NUM}; // 按低两位查立即数的类型
+#define LVAL_IMM_MIN (INTPTR_MIN >> 1)
+#define LVAL_IMM_MAX (INTPTR_MAX >> 1)
+#define LVAL_IS_IMM(v) (((intptr_t)(v)) & 3)
+#define LVAL_IS_INT(v) (((intptr_t)(v)) & 1)
+#define LVAL_IMM(n) ((lval *)(((uintptr_t)(intptr_t)(n) << 1) | 1))
+#define LVAL_TYPE(v) (LVAL_IS_IMM(v) ? limm_type[((intptr_t)(v)) & 3] : (v)->type)
+#define LVAL_NUMV(v) (LVAL_IS_INT(v) ? (long)(((intptr_t)(v)) >> 1) : (v)->num)
+#define LVAL_DBLV(v) (LVAL_IS_IMM(v) ? ldbl_unimm(v) : (v)->dbl)
+#define LVAL_IS_BIG(v) (!LVAL_IS_IMM(v) && (v)->type == LVAL_NUM && (v)->big)
+#define LVAL_IS_LONG(v) (LVAL_IS_INT(v) || (!LVAL_IS_IMM(v) && (v)->type == LVAL_NUM && !(v)->big))
+#define LVAL_IS_NUMBER(v) (LVAL_TYPE(v) == LVAL_NUM || LVAL_TYPE(v) == LVAL_DBL)
 
-  int count;
-  lval **cell;
+// 浮点数编码进指针: 符号位转到最低位, 指数减掉偏移后只留 9 位 (约 2^-255 到 2^256),
+// 尾数完整保留, 所以不丢精度. 0 直接编码, 超出范围的和 inf / nan 才分配 lval
+#define LDBL_BIAS ((uint64_t)(1023 - 256) << 53)
+lval *ldbl_imm(double d)
+{
+#if UINTPTR_MAX > 0xffffffffu
+  uint64_t u;
+  memcpy(&u, &d, sizeof(u));
+  uint64_t r = (u << 1) | (u >> 63);
+  if (r > 1)
+  {
+    r -= LDBL_BIAS;
+    if (r >> 62 || r <= 1)
+      return NULL;
+  }
+  return (lval *)(uintptr_t)((r << 2) | 2);
+#else
+  return NULL;
+#endif
+}
+double ldbl_unimm(lval *v)
+{
+  uint64_t r = (uintptr_t)v >> 2;
+  if (r > 1)
+    r += LDBL_BIAS;
+  uint64_t u = (r >> 1) | (r << 63);
+  double d;
+  memcpy(&d, &u, sizeof(d));
+  return d;
+}
+
+#define FORLESS(count) for (int i = 0; i < count; i++)
+
+// 内存池: 每种大小一个空闲链表, 不够时向系统申请一整块(chunk)再切成小块
+// lalloc_use_malloc 为 1 时(--malloc)直接走 malloc/free, 方便用 valgrind/asan 调试
+// chunk 按自身大小对齐, 这样从任意 slot 地址就能找到所在的 chunk
+#define LPOOL_CHUNK_SIZE (64 * 1024)
+#define LCHUNK_OF(x) ((lchunk *)((uintptr_t)(x) & ~(uintptr_t)(LPOOL_CHUNK_SIZE - 1)))
+#define LCELLS_CLASSES 7 // cell 数组按 1, 2, 4 ... 64 个元素分级, 更大的直接 malloc
+typedef struct lchunk lchunk;
+typedef struct lpool lpool;
+struct lchunk
+{
+  lchunk *next;
+  lpool *pool;
+  uint64_t *bits; // 只有 gc 管理的池才有, 见 LBIT_*
+  long live;      // arena 的 chunk 里还没释放的对象数, 顺便让后面的 slot 按 16 字节对齐
+};
+struct lpool
+{
+  size_t size;
+  int traced; // lval 和 lenv 由 gc 管理
+  void *free;
+  lchunk *chunks;
+  int nchunks;
+  long live;
+};
+// 每个 chunk 上的位图, 每个 slot 一位
+enum
+{
+  LBIT_LIVE,       // 已分配
+  LBIT_MARK,       // 本次回收中可达
+  LBIT_OLD,        // 分代模式下已晋升到老年代
+  LBIT_REMEMBERED, // 已经在 remembered set 里
+  LBIT_MAPS
+};
+
+enum
+{
+  LGC_RC,        // 引用计数, 默认
+  LGC_MARKSWEEP, // 标记-清除
+  LGC_GEN        // 标记-清除 + 新生代
 };
+int lgc_mode = LGC_RC;
+void lgc_maybe_collect();
+void lgc_track(lpool *p, void *x);
+
+int lalloc_use_malloc = 0;
+int lalloc_trim = 0;
+// 每条顶层语句的临时对象 (--arena): lval 从 arena 的 chunk 里顺序切出来,
+// 释放时只给所在 chunk 的计数减一, 整块都释放了就整块重用
+// 存进 arena 之外的环境(全局环境等)的值先用 lval_promote 搬到普通的池里
+int larena_enabled = 0; // 命令行打开, 只能和引用计数一起用
+int larena_on = 0;      // 正在求值顶层语句
+lpool larena_pool;      // 只用来标记 arena 的 chunk
+struct
+{
+  lchunk *cur;
+  char *ptr;
+  char *end;
+  lchunk *spare; // 整块空闲的 chunk
+} larena;
+lchunk *lchunk_new(lpool *p);
+void lchunk_free(lchunk *c);
+void *larena_alloc(size_t size)
+{
+  if (larena.cur == NULL || larena.ptr + size > larena.end)
+  {
+    lchunk *c = larena.spare;
+    if (c)
+      larena.spare = c->next;
+    else
+      c = lchunk_new(&larena_pool);
+    c->live = 0;
+    larena.cur = c;
+    larena.ptr = (char *)(c + 1);
+    larena.end = (char *)c + LPOOL_CHUNK_SIZE;
+  }
+  void *x = larena.ptr;
+  larena.ptr += size;
+  larena.cur->live++;
+  return x;
+}
+void larena_free(void *x)
+{
+  lchunk *c = LCHUNK_OF(x);
+  if (--c->live > 0)
+    return;
+  if (c == larena.cur)
+  {
+    larena.ptr = (char *)(c + 1);
+    return;
+  }
+  c->next = larena.spare;
+  larena.spare = c;
+}
+int larena_has(void *x)
+{
+  return larena_enabled && x && !LVAL_IS_IMM(x) && LCHUNK_OF(x)->pool == &larena_pool;
+}
+void larena_trim()
+{
+  while (larena.spare)
+  {
+    lchunk *c = larena.spare;
+    larena.spare = c->next;
+    lchunk_free(c);
+  }
+}
+lpool lval_pool = {sizeof(lval), 1};
+lpool lcells_pool[LCELLS_CLASSES] = {
+    {sizeof(lval *) * 1},
+    {sizeof(lval *) * 2},
+    {sizeof(lval *) * 4},
+    {sizeof(lval *) * 8},
+    {sizeof(lval *) * 16},
+    {sizeof(lval *) * 32},
+    {sizeof(lval *) * 64},
+};
+
+int lpool_slots(lpool *p)
+{
+  return (LPOOL_CHUNK_SIZE - sizeof(lchunk)) / p->size;
+}
+int lpool_bitwords(lpool *p)
+{
+  return (lpool_slots(p) + 63) / 64;
+}
+char *lpool_slot(lchunk *c, lpool *p, int i)
+{
+  return (char *)(c + 1) + p->size * i;
+}
+int lchunk_index(lchunk *c, void *x)
+{
+  return ((char *)x - (char *)(c + 1)) / c->pool->size;
+}
+int lchunk_bit(lchunk *c, int map, int i)
+{
+  return (c->bits[map * lpool_bitwords(c->pool) + i / 64] >> (i % 64)) & 1;
+}
+void lchunk_setbit(lchunk *c, int map, int i, int on)
+{
+  uint64_t *w = &c->bits[map * lpool_bitwords(c->pool) + i / 64];
+  if (on)
+    *w |= (uint64_t)1 << (i % 64);
+  else
+    *w &= ~((uint64_t)1 << (i % 64));
+}
+lchunk *lchunk_new(lpool *p)
+{
+#ifdef __WIN32
+  lchunk *c = _aligned_malloc(LPOOL_CHUNK_SIZE, LPOOL_CHUNK_SIZE);
+#else
+  lchunk *c = aligned_alloc(LPOOL_CHUNK_SIZE, LPOOL_CHUNK_SIZE);
+#endif
+  c->pool = p;
+  c->bits = p->traced ? calloc(LBIT_MAPS * lpool_bitwords(p), sizeof(uint64_t)) : NULL;
+  return c;
+}
+void lchunk_free(lchunk *c)
+{
+  free(c->bits);
+#ifdef __WIN32
+  _aligned_free(c);
+#else
+  free(c);
+#endif
+}
+void *lpool_alloc(lpool *p)
+{
+  if (lalloc_use_malloc)
+    return malloc(p->size);
+  if (larena_on && p == &lval_pool)
+    return larena_alloc(p->size);
+  if (p->traced && lgc_mode != LGC_RC)
+    lgc_maybe_collect();
+  if (!p->free)
+  {
+    // 整块申请, 倒序串进空闲链表, 这样分配顺序和地址顺序一致
+    lchunk *c = lchunk_new(p);
+    c->next = p->chunks;
+    p->chunks = c;
+    p->nchunks++;
+    for (int i = lpool_slots(p) - 1; i >= 0; i--)
+    {
+      void **slot = (void **)lpool_slot(c, p, i);
+      *slot = p->free;
+      p->free = slot;
+    }
+  }
+  void **x = p->free;
+  p->free = *x;
+  p->live++;
+  if (p->traced && lgc_mode != LGC_RC)
+    lgc_track(p, x);
+  return x;
+}
+void lpool_free(lpool *p, void *x)
+{
+  if (lalloc_use_malloc)
+  {
+    free(x);
+    return;
+  }
+  if (larena_has(x))
+  {
+    larena_free(x);
+    return;
+  }
+  if (p->traced && lgc_mode != LGC_RC)
+  {
+    lchunk *c = LCHUNK_OF(x);
+    int idx = lchunk_index(c, x);
+    FORLESS(LBIT_MAPS)
+    {
+      lchunk_setbit(c, i, idx, 0);
+    }
+  }
+  p->live--;
+  *(void **)x = p->free;
+  p->free = x;
+}
+int lchunk_cmp(const void *a, const void *b)
+{
+  uintptr_t x = (uintptr_t)*(lchunk **)a;
+  uintptr_t y = (uintptr_t)*(lchunk **)b;
+  return x < y ? -1 : x > y;
+}
+// chunks 按地址排好序, 二分找到 x 所在的 chunk
+int lchunk_find(lchunk **chunks, int n, void *x)
+{
+  int lo = 0, hi = n - 1;
+  while (lo < hi)
+  {
+    int mid = (lo + hi + 1) / 2;
+    if ((uintptr_t)chunks[mid] <= (uintptr_t)x)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return lo;
+}
+// 把完全空闲的 chunk 还给系统, 在两条顶层语句之间调用(--trim)
+void lpool_trim(lpool *p)
+{
+  if (lalloc_use_malloc || p->nchunks == 0)
+    return;
+  int n = 0;
+  lchunk **chunks = malloc(sizeof(lchunk *) * p->nchunks);
+  int *frees = calloc(p->nchunks, sizeof(int));
+  for (lchunk *c = p->chunks; c; c = c->next)
+    chunks[n++] = c;
+  qsort(chunks, n, sizeof(lchunk *), lchunk_cmp);
+  for (void **x = p->free; x; x = *x)
+    frees[lchunk_find(chunks, n, x)]++;
 
-#define NEWLVAL lval *v = malloc(sizeof(lval))
+  // 重新串空闲链表, 跳过整块空闲的 chunk 里的 slot
+  int slots = lpool_slots(p);
+  void **x = p->free;
+  p->free = NULL;
+  while (x)
+  {
+    void **next = *x;
+    if (frees[lchunk_find(chunks, n, x)] != slots)
+    {
+      *x = p->free;
+      p->free = x;
+    }
+    x = next;
+  }
+  p->chunks = NULL;
+  p->nchunks = 0;
+  FORLESS(n)
+  {
+    if (frees[i] == slots)
+    {
+      lchunk_free(chunks[i]);
+      continue;
+    }
+    chunks[i]->next = p->chunks;
+    p->chunks = chunks[i];
+    p->nchunks++;
+  }
+  free(chunks);
+  free(frees);
+}
+int lcells_class(int n)
+{
+  int k = 0;
+  while ((1 << k) < n)
+    k++;
+  return k;
+}
+// 列表元素的存储, 多个列表可以共享同一个 lbuf 的不同段
+// lbuf 对 items[lo, used) 里的每个元素持有一个引用
+// 只有末尾正好是 used 的列表才能原地往后追加
+struct lbuf
+{
+  int rc;
+  int lo;
+  int used;
+  int cap;
+  lval *items[];
+};
+// 头部正好占两个指针, 整个 lbuf 的大小仍然是 2 的幂
+lbuf *lbuf_new(int n)
+{
+  int k = lcells_class(n + 2);
+  lbuf *b = k < LCELLS_CLASSES ? lpool_alloc(&lcells_pool[k]) : malloc(sizeof(lval *) << k);
+  b->rc = 1;
+  b->lo = 0;
+  b->used = 0;
+  b->cap = (1 << k) - 2;
+  return b;
+}
+void lval_del(lval *v);
+lval *lval_ref(lval *v);
+void lbuf_release(lbuf *b)
+{
+  if (b == NULL || --b->rc > 0)
+    return;
+  for (int i = b->lo; i < b->used; i++)
+  {
+    lval_del(b->items[i]);
+  }
+  int k = lcells_class(b->cap + 2);
+  if (k < LCELLS_CLASSES)
+    lpool_free(&lcells_pool[k], b);
+  else
+    free(b);
+}
+// LOOKUP 的内联缓存: 记下上次在全局环境里找到的值, 全局环境没变过 (version 相同)
+// 并且没有别的环境绑定这个符号时直接用, 见 lvm_lookup
+typedef struct lcache
+{
+  unsigned long version;
+  lval *val; // 不持有引用, 值被替换时 version 一定会变
+} lcache;
+// 字节码, 见 lval_compile
+struct lcode
+{
+  int rc;
+  int depth; // 运行时栈最多用到几格
+  int nops;
+  int nconsts;
+  int nlocals;
+  int *ops;
+  lval **consts; // 不持有引用, 都是源表达式里的元素, 跟着源表达式的 lbuf 存活
+  int *locals;   // 编译时按哪个 lambda 的形参分配的槽位, 见 lval_code
+  int ncaches;
+  lcache *caches; // 每个 LOOKUP 一个
+  unsigned long fold_version; // 编译时的 lenv_fold_version, 见 LOP_FOLD
+  int calls;                  // 作为 lambda body 被调用的次数, 到 LJIT_THRESHOLD 时尝试 JIT
+  ljit *jit;
+};
+void ljit_free(ljit *j);
+void lcode_release(lcode *c)
+{
+  if (c == NULL || --c->rc > 0)
+    return;
+  free(c->ops);
+  free(c->consts);
+  free(c->locals);
+  free(c->caches);
+  ljit_free(c->jit);
+  free(c);
+}
+void lval_uncode(lval *v)
+{
+  lcode_release(v->code);
+  v->code = NULL;
+}
+#define NEWLVAL                     \
+  lval *v = lpool_alloc(&lval_pool); \
+  v->rc = 1
 #define StringNew(s) malloc(sizeof(char) * strlength(s))
 #define StringNewCpy(sptr, s) \
   sptr = StringNew(s);        \
   strcpy(sptr, s)
-#define FORLESS(count) for (int i = 0; i < count; i++)
 #define LASSERT(arg, cond, fmt, ...)          \
   if (!(cond))                                \
   {                                           \
@@ -102,157 +590,911 @@ struct lval
 #define LASSERT_NUM(func, arg, expect) LASSERT(arg, arg->count == expect, "Function '%s' passed invalid count of Arguments." \
                                                                           "Got %i, Expect %i",                               \
                                                func, arg->count, expect)
-#define LASSERT_TYPE(func, arg, i, expect) LASSERT(arg, arg->cell[i]->type == expect, "Function '%s' passed invalid format type." \
+#define LASSERT_TYPE(func, arg, i, expect) LASSERT(arg, LVAL_TYPE(arg->cell[i]) == expect, "Function '%s' passed invalid format type." \
                                                                                       "Got %s, Expect %s",                        \
-                                                   func, ltype_name(arg->cell[i]->type), ltype_name(expect))
+                                                   func, ltype_name(LVAL_TYPE(arg->cell[i])), ltype_name(expect))
 #define LASSERT_NOT_EMPTY(func, arg, i) LASSERT(arg, arg->cell[i]->count != 0, "Function '%s' passed '{}' empty argument at index: %i!", func, i)
 
+// 符号表: 同名符号只存一份, 之后只用编号比较
+typedef struct lsym
+{
+  char *name;
+  unsigned hash;
+  int shadow; // 全局环境以外还有几个活着的环境绑定了这个符号, 见 lvm_lookup
+} lsym;
+lsym *lsyms = NULL; // 按编号存
+int lsyms_count = 0;
+int *lsyms_index = NULL; // 开放寻址的哈希表, 存编号 + 1, 0 表示空
+int lsyms_index_cap = 0;
+int lsym_amp; // "&"
+
+unsigned lsym_hash(char *s)
+{
+  unsigned h = 2166136261u;
+  while (*s)
+  {
+    h = (h ^ (unsigned char)*s++) * 16777619u;
+  }
+  return h;
+}
+void lsyms_rehash(int cap)
+{
+  free(lsyms_index);
+  lsyms_index = calloc(cap, sizeof(int));
+  lsyms_index_cap = cap;
+  FORLESS(lsyms_count)
+  {
+    int k = lsyms[i].hash & (cap - 1);
+    while (lsyms_index[k])
+      k = (k + 1) & (cap - 1);
+    lsyms_index[k] = i + 1;
+  }
+}
+int lsym_intern(char *name)
+{
+  if (lsyms_count * 2 >= lsyms_index_cap)
+    lsyms_rehash(lsyms_index_cap ? lsyms_index_cap * 2 : 256);
+  unsigned h = lsym_hash(name);
+  int k = h & (lsyms_index_cap - 1);
+  while (lsyms_index[k])
+  {
+    lsym *s = &lsyms[lsyms_index[k] - 1];
+    if (s->hash == h && strcmp(s->name, name) == 0)
+      return lsyms_index[k] - 1;
+    k = (k + 1) & (lsyms_index_cap - 1);
+  }
+  lsyms = realloc(lsyms, sizeof(lsym) * (lsyms_count + 1));
+  StringNewCpy(lsyms[lsyms_count].name, name);
+  lsyms[lsyms_count].hash = h;
+  lsyms[lsyms_count].shadow = 0;
+  lsyms_index[k] = lsyms_count + 1;
+  return lsyms_count++;
+}
+char *lsym_name(int id)
+{
+  return lsyms[id].name;
+}
+
 /////////////
 void lval_print(lval *v);
 void lval_println(lval *v);
 lval *lval_eval(lenv *e, lval *v);
+lval *lval_eval_top(lenv *e, lval *v);
+lcode *lval_code(lval *v, lval *formals);
+int lvm_enabled = 1; // --eval=tree 时为 0
+// 虚拟机的值栈, 每次 lcode_run 占用其中一段; 只保留虚拟空间, 用到才真正分配
+#define LVM_STACK_MAX (1 << 20)
+lval **lvm_stack = NULL;
+int lvm_sp = 0;
+// 非尾位置的 lambda 调用 (以及 if / eval) 不递归调用 lcode_run, 而是把调用者的状态
+// 存成一帧放进 lvm_frames, 被调用者返回时再取出来. 帧数超过 lvm_max_depth (--max-depth=)
+// 时返回错误, 不会把 C 栈用完
+typedef struct lframe
+{
+  lcode *c;
+  lenv *e;
+  lval *src;
+  int own;
+  int *pc;
+  int base;
+  int sp;
+} lframe;
+lframe *lvm_frames = NULL;
+int lvm_nframes = 0;
+int lvm_frames_cap = 0;
+int lvm_max_depth = 100000;
+// 树形求值, 内建函数里再求值等仍然会递归, 用掉的 C 栈超过 LVAL_C_STACK 时报错
+#define LVAL_C_STACK (4 << 20)
+char *lval_stack_base = NULL;
+int lval_deep()
+{
+  char here;
+  return lval_stack_base && lval_stack_base - &here > LVAL_C_STACK;
+}
 lenv *lenv_new();
 void lenv_del(lenv *e);
 lenv *lenv_copy(lenv *);
+lenv *lenv_share(lenv *);
+lmemo *lmemo_share(lmemo *m);
+void lmemo_release(lmemo *m);
+void lmemo_mark(lmemo *m);
 /////////////
 
 lval *lval_num(long num)
 {
+  if (num >= LVAL_IMM_MIN && num <= LVAL_IMM_MAX)
+    return LVAL_IMM(num);
   NEWLVAL;
   v->type = LVAL_NUM;
   v->num = num;
+  v->big = NULL;
   return v;
 }
-lval *lval_err(char *fmt, ...)
-{
-  NEWLVAL;
-  v->type = LVAL_ERR;
-  va_list va;
-  va_start(va, fmt);
-  static int ERR_LENGTH = 512;
-  v->err = malloc(ERR_LENGTH);
-  vsnprintf(v->err, ERR_LENGTH - 1, fmt, va);
-  v->err = realloc(v->err, strlength(v->err));
-  va_end(va);
-  return v;
-}
-lval *lval_sym(char *op)
+
+// 大整数: 符号 + 绝对值, 绝对值按 32 位一段从低到高存 (d[n-1] 不为 0). 创建后不再修改, 拷贝时共享
+// 整数总是用放得下的最小表示: 立即数, long, 最后才是 lbig, 所以相等的数表示也相同
+#define LBIG_KARATSUBA 32 // 两个数都至少这么多段时用 Karatsuba 乘法
+struct lbig
 {
-  NEWLVAL;
-  v->type = LVAL_SYM;
-  StringNewCpy(v->sym, op);
-  return v;
-}
-lval *lval_str(char *str)
+  int rc;
+  int neg;
+  int n;
+  uint32_t d[];
+};
+lbig *lbig_new(int n)
 {
-  NEWLVAL;
-  v->type = LVAL_STR;
-  StringNewCpy(v->str, str);
-  return v;
+  lbig *b = calloc(1, sizeof(lbig) + sizeof(uint32_t) * (n ? n : 1));
+  b->rc = 1;
+  b->n = n;
+  return b;
 }
-lval *lval_fun(lbuildin fun)
+void lbig_release(lbig *b)
 {
-  NEWLVAL;
-  v->type = LVAL_FUN;
-  v->buildin = fun;
-  return v;
+  if (--b->rc == 0)
+    free(b);
 }
-lval *lval_lambda(lval *formals, lval *body)
+lbig *lbig_trim(lbig *b)
 {
-  NEWLVAL;
-  v->type = LVAL_FUN;
-  v->buildin = NULL;
-  v->formals = formals;
-  v->body = body;
-  v->env = lenv_new();
-  return v;
+  while (b->n && b->d[b->n - 1] == 0)
+    b->n--;
+  if (b->n == 0)
+    b->neg = 0;
+  return b;
 }
-lval *lval_sexpr(void)
+lbig *lbig_from_long(long x)
 {
-  NEWLVAL;
-  v->type = LVAL_SEXPR;
-  v->count = 0;
-  v->cell = NULL;
-  return v;
+  lbig *b = lbig_new(2);
+  unsigned long m = x < 0 ? -(unsigned long)x : (unsigned long)x;
+  b->neg = x < 0;
+  b->d[0] = (uint32_t)m;
+  b->d[1] = (uint32_t)(m >> 32);
+  return lbig_trim(b);
 }
-lval *lval_qexpr(void)
+// 放得进 long 时写进 out 并返回 1
+int lbig_to_long(lbig *b, long *out)
 {
-  NEWLVAL;
-  v->type = LVAL_QEXPR;
-  v->count = 0;
-  v->cell = NULL;
-  return v;
+  if (b->n > 2)
+    return 0;
+  unsigned long m = b->n ? b->d[0] : 0;
+  if (b->n == 2)
+    m |= (unsigned long)b->d[1] << 32;
+  if (b->neg ? m > (unsigned long)LONG_MAX + 1 : m > LONG_MAX)
+    return 0;
+  *out = b->neg ? (long)(0 - m) : (long)m;
+  return 1;
 }
-lval *lval_check_num(char *numstr)
+int lmag_cmp(const uint32_t *a, int an, const uint32_t *b, int bn)
 {
-  errno = 0;
-  long num = strtol(numstr, NULL, 10);
-  return errno != 0 ? lval_err("invalid err!") : lval_num(num);
+  while (an && a[an - 1] == 0)
+    an--;
+  while (bn && b[bn - 1] == 0)
+    bn--;
+  if (an != bn)
+    return an < bn ? -1 : 1;
+  for (int i = an - 1; i >= 0; i--)
+  {
+    if (a[i] != b[i])
+      return a[i] < b[i] ? -1 : 1;
+  }
+  return 0;
 }
-lval *lval_check_string(char *content)
+// out[0..on) += x[0..xn), 进位一直传到 out 末尾
+void lmag_add_into(uint32_t *out, int on, const uint32_t *x, int xn)
 {
-  content[strlen(content) - 1] = '\0';
-  char *cpy = malloc(strlen(content));
-  strcpy(cpy, content + 1);
-  lval *strVal = lval_str(cpy);
-  free(cpy);
-  return strVal;
+  uint64_t carry = 0;
+  for (int i = 0; i < on && (i < xn || carry); i++)
+  {
+    uint64_t t = (uint64_t)out[i] + (i < xn ? x[i] : 0) + carry;
+    out[i] = (uint32_t)t;
+    carry = t >> 32;
+  }
 }
-void lval_del(lval *v);
-void lval_expr_del(lval *v)
+// out[0..on) -= x[0..xn), 要求 out >= x
+void lmag_sub_from(uint32_t *out, int on, const uint32_t *x, int xn)
 {
-  FORLESS(v->count)
+  int64_t borrow = 0;
+  for (int i = 0; i < on && (i < xn || borrow); i++)
   {
-    lval_del(v->cell[i]);
+    int64_t t = (int64_t)out[i] - (i < xn ? x[i] : 0) - borrow;
+    out[i] = (uint32_t)t;
+    borrow = t < 0;
   }
-  free(v->cell);
 }
-void lval_del(lval *v)
+// out[0..an+bn) = a * b, out 不能和 a b 重叠
+void lmag_mul(const uint32_t *a, int an, const uint32_t *b, int bn, uint32_t *out)
 {
-  switch (v->type)
+  if (an < bn)
   {
-  case LVAL_ERR:
-    free(v->err);
-    break;
-  case LVAL_FUN:
-    if (!v->buildin)
+    const uint32_t *t = a;
+    a = b;
+    b = t;
+    int tn = an;
+    an = bn;
+    bn = tn;
+  }
+  memset(out, 0, sizeof(uint32_t) * (an + bn));
+  if (bn < LBIG_KARATSUBA)
+  {
+    FORLESS(bn)
     {
-      lval_del(v->formals);
-      lval_del(v->body);
-      lenv_del(v->env);
+      uint64_t carry = 0;
+      for (int j = 0; j < an; j++)
+      {
+        uint64_t t = (uint64_t)b[i] * a[j] + out[i + j] + carry;
+        out[i + j] = (uint32_t)t;
+        carry = t >> 32;
+      }
+      out[i + an] = (uint32_t)carry;
     }
-    break;
-  case LVAL_NUM:
-    break;
-  case LVAL_SYM:
-    free(v->sym);
-    break;
-  case LVAL_STR:
-    free(v->str);
-    break;
-  case LVAL_QEXPR:
-  case LVAL_SEXPR:
-    lval_expr_del(v);
-    break;
+    return;
+  }
+  int m = an / 2;
+  if (bn <= m)
+  {
+    // b 比 a 的一半还短: 只拆 a, a1 * b 错开 m 段加上去
+    uint32_t *t = malloc(sizeof(uint32_t) * (an - m + bn));
+    lmag_mul(a, m, b, bn, out);
+    lmag_mul(a + m, an - m, b, bn, t);
+    lmag_add_into(out + m, an + bn - m, t, an - m + bn);
+    free(t);
+    return;
   }
-  free(v);
+  // a = a1 B^m + a0, b = b1 B^m + b0
+  // a b = z2 B^2m + (z1 - z2 - z0) B^m + z0, z1 = (a0 + a1)(b0 + b1)
+  int sn = an - m + 1, tn = (bn > an - m ? bn - m : an - m) + 1;
+  sn = sn > m + 1 ? sn : m + 1;
+  tn = tn > m + 1 ? tn : m + 1;
+  uint32_t *s1 = calloc(sn, sizeof(uint32_t));
+  uint32_t *s2 = calloc(tn, sizeof(uint32_t));
+  memcpy(s1, a, sizeof(uint32_t) * m);
+  lmag_add_into(s1, sn, a + m, an - m);
+  memcpy(s2, b, sizeof(uint32_t) * m);
+  lmag_add_into(s2, tn, b + m, bn - m);
+  uint32_t *z1 = malloc(sizeof(uint32_t) * (sn + tn));
+  lmag_mul(s1, sn, s2, tn, z1);
+  uint32_t *z0 = malloc(sizeof(uint32_t) * 2 * m);
+  uint32_t *z2 = malloc(sizeof(uint32_t) * (an + bn - 2 * m));
+  lmag_mul(a, m, b, m, z0);
+  lmag_mul(a + m, an - m, b + m, bn - m, z2);
+  lmag_sub_from(z1, sn + tn, z0, 2 * m);
+  lmag_sub_from(z1, sn + tn, z2, an + bn - 2 * m);
+  int z1n = sn + tn;
+  while (z1n && z1[z1n - 1] == 0)
+    z1n--;
+  memcpy(out, z0, sizeof(uint32_t) * 2 * m);
+  memcpy(out + 2 * m, z2, sizeof(uint32_t) * (an + bn - 2 * m));
+  lmag_add_into(out + m, an + bn - m, z1, z1n);
+  free(s1);
+  free(s2);
+  free(z0);
+  free(z1);
+  free(z2);
 }
-lval *lval_add(lval *v, lval *a)
+// q = u / v (绝对值, 截断), v 最高段不为 0, un >= vn; q 有 un - vn + 1 段
+// Knuth 算法 D, 见 Hacker's Delight divmnu
+void lmag_div(const uint32_t *u, int m, const uint32_t *v, int n, uint32_t *q)
 {
-  v->count++;
-  v->cell = realloc(v->cell, sizeof(lval *) * v->count);
-  v->cell[v->count - 1] = a;
-  return v;
+  if (n == 1)
+  {
+    uint64_t r = 0;
+    for (int j = m - 1; j >= 0; j--)
+    {
+      uint64_t t = (r << 32) | u[j];
+      q[j] = (uint32_t)(t / v[0]);
+      r = t % v[0];
+    }
+    return;
+  }
+  int s = __builtin_clz(v[n - 1]);
+  uint32_t *vn = malloc(sizeof(uint32_t) * n);
+  uint32_t *un = malloc(sizeof(uint32_t) * (m + 1));
+  for (int i = n - 1; i > 0; i--)
+    vn[i] = (v[i] << s) | (uint32_t)((uint64_t)v[i - 1] >> (32 - s));
+  vn[0] = v[0] << s;
+  un[m] = (uint32_t)((uint64_t)u[m - 1] >> (32 - s));
+  for (int i = m - 1; i > 0; i--)
+    un[i] = (u[i] << s) | (uint32_t)((uint64_t)u[i - 1] >> (32 - s));
+  un[0] = u[0] << s;
+  const uint64_t b = (uint64_t)1 << 32;
+  for (int j = m - n; j >= 0; j--)
+  {
+    uint64_t num = ((uint64_t)un[j + n] << 32) | un[j + n - 1];
+    uint64_t qhat = num / vn[n - 1];
+    uint64_t rhat = num % vn[n - 1];
+    while (qhat >= b || qhat * vn[n - 2] > ((rhat << 32) | un[j + n - 2]))
+    {
+      qhat--;
+      rhat += vn[n - 1];
+      if (rhat >= b)
+        break;
+    }
+    int64_t k = 0, t;
+    FORLESS(n)
+    {
+      uint64_t p = qhat * vn[i];
+      t = (int64_t)un[i + j] - k - (int64_t)(p & 0xffffffff);
+      un[i + j] = (uint32_t)t;
+      k = (int64_t)(p >> 32) - (t >> 32);
+    }
+    t = (int64_t)un[j + n] - k;
+    un[j + n] = (uint32_t)t;
+    q[j] = (uint32_t)qhat;
+    if (t < 0)
+    {
+      // 估大了一, 加回去
+      q[j]--;
+      uint64_t c = 0;
+      FORLESS(n)
+      {
+        uint64_t w = (uint64_t)un[i + j] + vn[i] + c;
+        un[i + j] = (uint32_t)w;
+        c = w >> 32;
+      }
+      un[j + n] += (uint32_t)c;
+    }
+  }
+  free(vn);
+  free(un);
 }
-lval *lval_pop(lval *v, int i)
+// 带符号的加法, neg_b 为 1 时算 a - b
+lbig *lbig_add(lbig *a, lbig *b, int neg_b)
 {
-  lval *x = v->cell[i];
-  lval **a = &v->cell[i];
-  lval **b = &v->cell[i + 1];
-  memmove(a, b, sizeof(lval *) * (v->count - i - 1));
-  //    memmove(&v->cell[i], &v->cell[i+1], sizeof(lval*)*(v->count-i-1));
+  int bneg = b->neg ^ neg_b;
+  int n = (a->n > b->n ? a->n : b->n) + 1;
+  lbig *r = lbig_new(n);
+  if (a->neg == bneg)
+  {
+    memcpy(r->d, a->d, sizeof(uint32_t) * a->n);
+    lmag_add_into(r->d, n, b->d, b->n);
+    r->neg = a->neg;
+  }
+  else if (lmag_cmp(a->d, a->n, b->d, b->n) >= 0)
+  {
+    memcpy(r->d, a->d, sizeof(uint32_t) * a->n);
+    lmag_sub_from(r->d, n, b->d, b->n);
+    r->neg = a->neg;
+  }
+  else
+  {
+    memcpy(r->d, b->d, sizeof(uint32_t) * b->n);
+    lmag_sub_from(r->d, n, a->d, a->n);
+    r->neg = bneg;
+  }
+  return lbig_trim(r);
+}
+lbig *lbig_mul(lbig *a, lbig *b)
+{
+  if (a->n == 0 || b->n == 0)
+    return lbig_new(0);
+  lbig *r = lbig_new(a->n + b->n);
+  lmag_mul(a->d, a->n, b->d, b->n, r->d);
+  r->neg = a->neg ^ b->neg;
+  return lbig_trim(r);
+}
+// 和 C 一样向 0 截断, b 不为 0
+lbig *lbig_div(lbig *a, lbig *b)
+{
+  if (a->n < b->n)
+    return lbig_new(0);
+  lbig *r = lbig_new(a->n - b->n + 1);
+  lmag_div(a->d, a->n, b->d, b->n, r->d);
+  r->neg = a->neg ^ b->neg;
+  return lbig_trim(r);
+}
+int lbig_cmp(lbig *a, lbig *b)
+{
+  if (a->neg != b->neg)
+    return a->neg ? -1 : 1;
+  int c = lmag_cmp(a->d, a->n, b->d, b->n);
+  return a->neg ? -c : c;
+}
+// 十进制字符串, 调用者 free
+char *lbig_str(lbig *b)
+{
+  // 每次除以 10^9 取出 9 位
+  int n = b->n;
+  uint32_t *t = malloc(sizeof(uint32_t) * (n ? n : 1));
+  memcpy(t, b->d, sizeof(uint32_t) * n);
+  char *s = malloc(n * 10 + 3);
+  int len = 0;
+  while (n)
+  {
+    uint64_t r = 0;
+    for (int j = n - 1; j >= 0; j--)
+    {
+      uint64_t x = (r << 32) | t[j];
+      t[j] = (uint32_t)(x / 1000000000);
+      r = x % 1000000000;
+    }
+    while (n && t[n - 1] == 0)
+      n--;
+    for (int k = 0; k < 9 && (n || r); k++)
+    {
+      s[len++] = '0' + r % 10;
+      r /= 10;
+    }
+  }
+  if (len == 0)
+    s[len++] = '0';
+  if (b->neg)
+    s[len++] = '-';
+  s[len] = '\0';
+  for (int i = 0, j = len - 1; i < j; i++, j--)
+  {
+    char c = s[i];
+    s[i] = s[j];
+    s[j] = c;
+  }
+  free(t);
+  return s;
+}
+// 十进制整数 (可以带 '-'), 数字部分每 9 位一组乘进去
+lbig *lbig_parse(const char *s)
+{
+  int neg = *s == '-';
+  if (neg)
+    s++;
+  int digits = strlen(s);
+  lbig *b = lbig_new(digits / 9 + 2);
+  int n = 0;
+  while (*s)
+  {
+    uint32_t chunk = 0, scale = 1;
+    for (int k = 0; k < 9 && *s; k++, s++)
+    {
+      chunk = chunk * 10 + (*s - '0');
+      scale *= 10;
+    }
+    uint64_t carry = chunk;
+    FORLESS(n)
+    {
+      uint64_t t = (uint64_t)b->d[i] * scale + carry;
+      b->d[i] = (uint32_t)t;
+      carry = t >> 32;
+    }
+    if (carry)
+      b->d[n++] = (uint32_t)carry;
+  }
+  b->n = n;
+  b->neg = neg;
+  return lbig_trim(b);
+}
+// 用 b 生成数字, 接管 b 的引用; 放得进 long 的换回普通表示
+lval *lval_big(lbig *b)
+{
+  long x;
+  if (lbig_to_long(b, &x))
+  {
+    lbig_release(b);
+    return lval_num(x);
+  }
+  NEWLVAL;
+  v->type = LVAL_NUM;
+  v->num = b->neg ? LONG_MIN : LONG_MAX;
+  v->big = b;
+  return v;
+}
+// 数字 v 的 lbig 表示 (新的引用)
+lbig *lval_to_big(lval *v)
+{
+  if (LVAL_IS_BIG(v))
+  {
+    v->big->rc++;
+    return v->big;
+  }
+  return lbig_from_long(LVAL_NUMV(v));
+}
+// 两个数字比大小, 返回 -1 0 1
+int lval_num_cmp(lval *a, lval *b)
+{
+  if (!LVAL_IS_BIG(a) && !LVAL_IS_BIG(b))
+  {
+    long x = LVAL_NUMV(a), y = LVAL_NUMV(b);
+    return x < y ? -1 : x > y;
+  }
+  lbig *x = lval_to_big(a);
+  lbig *y = lval_to_big(b);
+  int c = lbig_cmp(x, y);
+  lbig_release(x);
+  lbig_release(y);
+  return c;
+}
+lval *lval_dbl(double d)
+{
+  lval *x = ldbl_imm(d);
+  if (x)
+    return x;
+  NEWLVAL;
+  v->type = LVAL_DBL;
+  v->dbl = d;
+  return v;
+}
+double lbig_to_double(lbig *b)
+{
+  double d = 0;
+  for (int i = b->n - 1; i >= 0; i--)
+    d = d * 4294967296.0 + b->d[i];
+  return b->neg ? -d : d;
+}
+double lval_to_double(lval *v)
+{
+  if (LVAL_TYPE(v) == LVAL_DBL)
+    return LVAL_DBLV(v);
+  return LVAL_IS_BIG(v) ? lbig_to_double(v->big) : (double)LVAL_NUMV(v);
+}
+// d 是整数时返回同样大小的整数 (可能是大整数), 否则返回 NULL
+lval *lval_dbl_int(double d)
+{
+  if (d != d || d - d != 0) // nan, inf
+    return NULL;
+  if (d > -9.2e18 && d < 9.2e18)
+    return d == (double)(long)d ? lval_num((long)d) : NULL;
+  // 这么大的浮点数一定是整数: 53 位尾数左移
+  uint64_t u;
+  memcpy(&u, &d, sizeof(u));
+  int shift = (int)((u >> 52) & 0x7ff) - 1075;
+  unsigned __int128 m = (unsigned __int128)((u & (((uint64_t)1 << 52) - 1)) | ((uint64_t)1 << 52)) << (shift % 32);
+  lbig *b = lbig_new(shift / 32 + 3);
+  FORLESS(3)
+  {
+    b->d[shift / 32 + i] = (uint32_t)(m >> (32 * i));
+  }
+  b->neg = d < 0;
+  return lval_big(lbig_trim(b));
+}
+// 数值相等: 整数和浮点数之间要精确相等
+int lval_num_eq(lval *x, lval *y)
+{
+  int tx = LVAL_TYPE(x), ty = LVAL_TYPE(y);
+  if (tx == LVAL_NUM && ty == LVAL_NUM)
+    return lval_num_cmp(x, y) == 0;
+  if (tx == LVAL_DBL && ty == LVAL_DBL)
+    return LVAL_DBLV(x) == LVAL_DBLV(y);
+  if (tx == LVAL_DBL)
+  {
+    lval *t = x;
+    x = y;
+    y = t;
+  }
+  lval *n = lval_dbl_int(LVAL_DBLV(y));
+  int res = n && lval_num_cmp(x, n) == 0;
+  if (n)
+    lval_del(n);
+  return res;
+}
+
+// 数值向量: 同一种元素 (long 或 double) 连续存放在头后面, 创建后不再修改, 拷贝时共享
+// 逐元素运算和归约见 lvec_binop. 矩阵是按行排列的 lvec, 另外记下行列数
+#define LVAL_IS_ARRAY(v) (LVAL_TYPE(v) == LVAL_VEC || LVAL_TYPE(v) == LVAL_MAT)
+enum
+{
+  LVEC_INT,
+  LVEC_DBL
+};
+struct lvec
+{
+  int rc;
+  int kind;
+  long n;
+  long rows, cols; // 只对矩阵有意义, 向量是 1 行
+  union
+  {
+    long *i;
+    double *d;
+  };
+};
+#define LVEC_MAX_LEN ((long)((SIZE_MAX - sizeof(lvec)) / sizeof(double)))
+// 元素个数超出范围或者分配失败时返回 NULL
+lvec *lvec_new(int kind, long n)
+{
+  if (n < 0 || n > LVEC_MAX_LEN)
+    return NULL;
+  lvec *x = malloc(sizeof(lvec) + sizeof(double) * (n ? n : 1));
+  if (x == NULL)
+    return NULL;
+  x->rc = 1;
+  x->kind = kind;
+  x->n = n;
+  x->rows = 1;
+  x->cols = n;
+  x->d = (double *)(x + 1);
+  return x;
+}
+void lvec_release(lvec *x)
+{
+  if (--x->rc == 0)
+    free(x);
+}
+lval *lval_vec(lvec *x)
+{
+  NEWLVAL;
+  v->type = LVAL_VEC;
+  v->vec = x;
+  return v;
+}
+lval *lval_mat(lvec *x, long rows, long cols)
+{
+  NEWLVAL;
+  v->type = LVAL_MAT;
+  x->rows = rows;
+  x->cols = cols;
+  v->vec = x;
+  return v;
+}
+lval *lvec_get(lvec *x, long i)
+{
+  return x->kind == LVEC_DBL ? lval_dbl(x->d[i]) : lval_num(x->i[i]);
+}
+// 元素相等的规则和 lval_num_eq 一样
+int lvec_equal(lvec *x, lvec *y)
+{
+  if (x->n != y->n || x->rows != y->rows)
+    return 0;
+  if (x->kind == LVEC_INT && y->kind == LVEC_INT)
+    return memcmp(x->i, y->i, sizeof(long) * x->n) == 0;
+  for (long i = 0; i < x->n; i++)
+  {
+    double a = x->kind == LVEC_DBL ? x->d[i] : (double)x->i[i];
+    double b = y->kind == LVEC_DBL ? y->d[i] : (double)y->i[i];
+    if (a != b)
+      return 0;
+    // long 转 double 可能不精确
+    if (x->kind != y->kind && (a <= -9.2e18 || a >= 9.2e18 || (x->kind == LVEC_INT ? x->i[i] : y->i[i]) != (long)a))
+      return 0;
+  }
+  return 1;
+}
+lval *lval_err(char *fmt, ...)
+{
+  NEWLVAL;
+  v->type = LVAL_ERR;
+  va_list va;
+  va_start(va, fmt);
+  static int ERR_LENGTH = 512;
+  v->err = malloc(ERR_LENGTH);
+  vsnprintf(v->err, ERR_LENGTH - 1, fmt, va);
+  v->err = realloc(v->err, strlength(v->err));
+  va_end(va);
+  return v;
+}
+lval *lval_sym(char *op)
+{
+  NEWLVAL;
+  v->type = LVAL_SYM;
+  v->sym = lsym_intern(op);
+  return v;
+}
+// 长字符串的存储, 多个 lval 共享, 内容不再修改
+struct lstr
+{
+  int rc;
+  char data[];
+};
+#define LSTR_OF(s) ((lstr *)((s) - offsetof(lstr, data)))
+void lval_str_release(lval *v)
+{
+  if (v->str == v->sso)
+    return;
+  lstr *s = LSTR_OF(v->str);
+  if (--s->rc == 0)
+    free(s);
+}
+lval *lval_strn(char *str, int len)
+{
+  NEWLVAL;
+  v->type = LVAL_STR;
+  v->len = len;
+  if (len < LVAL_SSO)
+    v->str = v->sso;
+  else
+  {
+    lstr *s = malloc(sizeof(lstr) + len + 1);
+    s->rc = 1;
+    v->str = s->data;
+  }
+  memcpy(v->str, str, len);
+  v->str[len] = '\0';
+  return v;
+}
+lval *lval_str(char *str)
+{
+  return lval_strn(str, strlen(str));
+}
+lval *lval_fun(lbuildin fun)
+{
+  NEWLVAL;
+  v->type = LVAL_FUN;
+  v->buildin = fun;
+  v->binop = NULL;
+  v->formals = NULL;
+  v->body = NULL;
+  return v;
+}
+// env 是部分应用时已经绑定的参数, 多个函数值共享, 不再修改; 没有时为 NULL
+lval *lval_lambda(lval *formals, lval *body, lenv *env)
+{
+  NEWLVAL;
+  v->type = LVAL_FUN;
+  v->buildin = NULL;
+  v->formals = formals;
+  v->body = body;
+  v->env = env;
+  return v;
+}
+lval *lval_sexpr(void)
+{
+  NEWLVAL;
+  v->type = LVAL_SEXPR;
+  v->count = 0;
+  v->cell = NULL;
+  v->buf = NULL;
+  v->code = NULL;
+  return v;
+}
+lval *lval_qexpr(void)
+{
+  NEWLVAL;
+  v->type = LVAL_QEXPR;
+  v->count = 0;
+  v->cell = NULL;
+  v->buf = NULL;
+  v->code = NULL;
+  return v;
+}
+lval *lval_check_num(char *numstr)
+{
+  errno = 0;
+  long num = strtol(numstr, NULL, 10);
+  if (errno == ERANGE)
+    return lval_big(lbig_parse(numstr));
+  return errno != 0 ? lval_err("invalid err!") : lval_num(num);
+}
+lval *lval_check_dbl(char *numstr)
+{
+  // 超出范围时 strtod 给出 inf 或 0, 直接用
+  return lval_dbl(strtod(numstr, NULL));
+}
+lval *lval_check_string(char *content)
+{
+  // 去掉两边的引号
+  return lval_strn(content + 1, strlen(content) - 2);
+}
+// 只释放 v 自己占用的内存, 不管子节点 (gc 清除时直接用)
+void lval_free(lval *v)
+{
+  switch (v->type)
+  {
+  case LVAL_ERR:
+    free(v->err);
+    break;
+  case LVAL_STR:
+    lval_str_release(v);
+    break;
+  case LVAL_QEXPR:
+  case LVAL_SEXPR:
+    lval_uncode(v);
+    lbuf_release(v->buf);
+    break;
+  case LVAL_MEMO:
+    lmemo_release(v->memo);
+    break;
+  case LVAL_NUM:
+    if (v->big)
+      lbig_release(v->big);
+    break;
+  case LVAL_VEC:
+  case LVAL_MAT:
+    lvec_release(v->vec);
+    break;
+  }
+  lpool_free(&lval_pool, v);
+}
+void lval_del(lval *v)
+{
+  // gc 模式下由回收器统一释放
+  if (LVAL_IS_IMM(v) || lgc_mode != LGC_RC || --v->rc > 0)
+    return;
+  switch (v->type)
+  {
+  case LVAL_FUN:
+    if (!v->buildin)
+    {
+      lval_del(v->formals);
+      lval_del(v->body);
+      if (v->env)
+        lenv_del(v->env);
+    }
+    break;
+  }
+  lval_free(v);
+}
+int lval_start(lval *v)
+{
+  return v->cell - v->buf->items;
+}
+// v 是否独占自己的 lbuf, 且 lbuf 里正好只有 v 这一段, 这时可以原地修改
+int lval_exclusive(lval *v)
+{
+  if (v->buf == NULL)
+    return 1;
+  int start = lval_start(v);
+  return v->buf->rc == 1 && v->buf->lo == start && v->buf->used == start + v->count;
+}
+// 把 v 的元素搬到一个新的 lbuf 里, 放在 front 处, 后面至少留到 n 个
+void lval_rebuf(lval *v, int n, int front)
+{
+  lval_uncode(v);
+  lbuf *b = lbuf_new(front + n);
+  b->lo = front;
+  b->used = front + v->count;
+  if (v->count)
+    memcpy(&b->items[front], v->cell, sizeof(lval *) * v->count);
+  if (v->buf && lval_exclusive(v))
+  {
+    // 元素的引用直接转给新的 lbuf
+    v->buf->used = v->buf->lo;
+  }
+  else
+  {
+    FORLESS(v->count)
+    {
+      lval_ref(v->cell[i]);
+    }
+  }
+  lbuf_release(v->buf);
+  v->buf = b;
+  v->cell = &b->items[front];
+}
+// 修改元素之前调用
+void lval_unshare(lval *v)
+{
+  lval_uncode(v);
+  if (!lval_exclusive(v))
+    lval_rebuf(v, v->count, 0);
+}
+// 保证 v 后面能追加到 n 个元素, 不够时容量翻倍
+void lval_reserve(lval *v, int n)
+{
+  if (v->buf && lval_start(v) + v->count == v->buf->used && lval_start(v) + n <= v->buf->cap)
+    return;
+  lval_rebuf(v, n > v->count * 2 ? n : v->count * 2, 0);
+}
+void lgc_write(void *x);
+lval *lval_add(lval *v, lval *a)
+{
+  lval_uncode(v);
+  lval_reserve(v, v->count + 1);
+  v->cell[v->count++] = a;
+  v->buf->used++;
+  lgc_write(v);
+  return v;
+}
+lval *lval_pop(lval *v, int i)
+{
+  lval_uncode(v);
+  lval *x = v->cell[i];
+  if (i == 0)
+  {
+    // 只移动视图的起点, lbuf 的内容不变
+    if (lval_exclusive(v))
+      v->buf->lo++;
+    else
+      lval_ref(x);
+    v->cell++;
+  }
+  else
+  {
+    lval_unshare(v);
+    memmove(&v->cell[i], &v->cell[i + 1], sizeof(lval *) * (v->count - i - 1));
+    v->buf->used--;
+  }
   v->count--;
-  v->cell = realloc(v->cell, sizeof(lval *) * v->count);
+  if (v->count == 0)
+  {
+    lbuf_release(v->buf);
+    v->buf = NULL;
+    v->cell = NULL;
+  }
   return x;
 }
 lval *lval_take(lval *v, int i)
@@ -261,624 +1503,3684 @@ lval *lval_take(lval *v, int i)
   lval_del(v);
   return x;
 }
+lval *lval_ref(lval *v)
+{
+  if (LVAL_IS_IMM(v))
+    return v;
+  // gc 模式下引用数只用来区分"是否被共享", 到 2 就不再增加
+  if (lgc_mode == LGC_RC)
+    v->rc++;
+  else
+    v->rc = 2;
+  return v;
+}
+// 浅拷贝: 新节点只属于调用者, 子节点仍然共享
 lval *lval_copy(lval *a)
 {
+  if (LVAL_IS_IMM(a))
+    return a;
   NEWLVAL;
   v->type = a->type;
   switch (v->type)
   {
   case LVAL_NUM:
     v->num = a->num;
+    v->big = a->big;
+    if (v->big)
+      v->big->rc++;
+    break;
+  case LVAL_DBL:
+    v->dbl = a->dbl;
     break;
   case LVAL_FUN:
   {
     if (a->buildin)
     {
       v->buildin = a->buildin;
+      v->binop = a->binop;
+      v->formals = NULL;
+      v->body = NULL;
     }
     else
     {
       v->buildin = NULL;
-      v->env = lenv_copy(a->env);
-      v->formals = lval_copy(a->formals);
-      v->body = lval_copy(a->body);
+      v->env = lenv_share(a->env);
+      v->formals = lval_ref(a->formals);
+      v->body = lval_ref(a->body);
+      lgc_write(v);
     }
   }
   break;
+  case LVAL_VEC:
+  case LVAL_MAT:
+    v->vec = a->vec;
+    v->vec->rc++;
+    break;
+  case LVAL_MEMO:
+    v->memo = lmemo_share(a->memo);
+    break;
   case LVAL_ERR:
     StringNewCpy(v->err, a->err);
     break;
   case LVAL_SYM:
-    StringNewCpy(v->sym, a->sym);
+    v->sym = a->sym;
     break;
   case LVAL_STR:
-    StringNewCpy(v->str, a->str);
+    v->len = a->len;
+    if (a->str == a->sso)
+    {
+      memcpy(v->sso, a->sso, a->len + 1);
+      v->str = v->sso;
+    }
+    else
+    {
+      v->str = a->str;
+      LSTR_OF(v->str)->rc++;
+    }
     break;
   case LVAL_SEXPR:
   case LVAL_QEXPR:
     v->count = a->count;
-    v->cell = malloc(sizeof(lval *) * v->count);
-    FORLESS(v->count)
-    {
-      v->cell[i] = lval_copy(a->cell[i]);
-    }
+    v->cell = a->cell;
+    v->buf = a->buf;
+    if (v->buf)
+      v->buf->rc++;
+    v->code = a->code;
+    if (v->code)
+      v->code->rc++;
     break;
   }
   return v;
 }
-struct lenv
+// 写时复制: 被共享时先拷贝一份再修改
+lval *lval_own(lval *v)
 {
-  lenv *pair; // 装父节点
-
-  int count;
-  char **syms;
+  if (LVAL_IS_IMM(v) || v->rc == 1)
+    return v;
+  lval *x = lval_copy(v);
+  lval_del(v);
+  return x;
+}
+// 变量少时顺序查找 syms; 全局环境或者变量多了之后,
+// 额外建一张开放寻址的哈希表 index (符号编号 -> 下标 + 1)
+#define LENV_INDEX_MIN 16
+struct lenv
+{
+  lenv *pair; // 装父节点
+  int rc;     // 作为函数捕获的环境时可以被多个函数值共享
+
+  int count;
+  int cap;
+  int *syms; // 符号编号
   lval **vals;
+
+  int *index;
+  int index_cap;
+  int temp;      // --arena 下求值时创建的, 属于 arena 里的 lambda
+  uint64_t mask; // 绑定过的符号 (编号 % 64), 查找时没有的环境直接跳过
+};
+#define LENV_BIT(sym) ((uint64_t)1 << ((sym) & 63))
+lenv *lenv_root = NULL;         // 全局环境
+unsigned long lenv_version = 1; // 全局环境每次 put / def 都加一
+unsigned long lenv_fold_version = 1; // 全局环境里能折叠的内建函数被重新定义时加一
+lpool lenv_pool = {sizeof(lenv), 1};
+void lalloc_trim_all()
+{
+  larena_trim();
+  lpool_trim(&lval_pool);
+  lpool_trim(&lenv_pool);
+  FORLESS(LCELLS_CLASSES)
+  {
+    lpool_trim(&lcells_pool[i]);
+  }
+}
+lenv *lenv_new()
+{
+  lenv *e = lpool_alloc(&lenv_pool);
+  e->rc = 1;
+  e->count = 0;
+  e->cap = 0;
+  e->pair = NULL;
+  e->syms = NULL;
+  e->vals = NULL;
+  e->index = NULL;
+  e->index_cap = 0;
+  e->temp = larena_on;
+  e->mask = 0;
+  return e;
+}
+unsigned lenv_slot(int sym, int cap)
+{
+  return ((unsigned)sym * 2654435761u) & (cap - 1);
+}
+// 建立(或扩大)哈希索引
+void lenv_index(lenv *e)
+{
+  int cap = e->index_cap ? e->index_cap : 64;
+  while (e->count * 2 >= cap)
+    cap *= 2;
+  free(e->index);
+  e->index = calloc(cap, sizeof(int));
+  e->index_cap = cap;
+  FORLESS(e->count)
+  {
+    unsigned k = lenv_slot(e->syms[i], cap);
+    while (e->index[k])
+      k = (k + 1) & (cap - 1);
+    e->index[k] = i + 1;
+  }
+}
+int lenv_find(lenv *e, int sym)
+{
+  if (e->index)
+  {
+    unsigned k = lenv_slot(sym, e->index_cap);
+    while (e->index[k])
+    {
+      if (e->syms[e->index[k] - 1] == sym)
+        return e->index[k] - 1;
+      k = (k + 1) & (e->index_cap - 1);
+    }
+    return -1;
+  }
+  FORLESS(e->count)
+  {
+    if (e->syms[i] == sym)
+      return i;
+  }
+  return -1;
+}
+void lenv_free(lenv *e)
+{
+  if (e != lenv_root)
+  {
+    FORLESS(e->count)
+    {
+      lsyms[e->syms[i]].shadow--;
+    }
+  }
+  free(e->index);
+  free(e->syms);
+  free(e->vals);
+  lpool_free(&lenv_pool, e);
+}
+void lenv_del(lenv *e)
+{
+  if (lgc_mode != LGC_RC || --e->rc > 0)
+    return;
+  FORLESS(e->count)
+  {
+    lval_del(e->vals[i]);
+  }
+  lenv_free(e);
+}
+lenv *lenv_copy(lenv *e)
+{
+  lenv *n = lpool_alloc(&lenv_pool);
+  n->rc = 1;
+  n->count = e->count;
+  n->cap = e->count;
+  n->pair = e->pair;
+  n->syms = malloc(sizeof(int) * n->count);
+  n->vals = malloc(sizeof(lval *) * n->count);
+  FORLESS(n->count)
+  {
+    n->syms[i] = e->syms[i];
+    n->vals[i] = lval_ref(e->vals[i]);
+    lsyms[n->syms[i]].shadow++;
+  }
+  n->index = NULL;
+  n->index_cap = 0;
+  n->temp = larena_on;
+  n->mask = e->mask;
+  if (e->index)
+  {
+    n->index = malloc(sizeof(int) * e->index_cap);
+    memcpy(n->index, e->index, sizeof(int) * e->index_cap);
+    n->index_cap = e->index_cap;
+  }
+  return n;
+}
+
+// 函数值拷贝时共享捕获的环境, 只加引用计数
+lenv *lenv_share(lenv *e)
+{
+  if (e)
+    e->rc++;
+  return e;
+}
+// 返回 v 在 arena 之外的一份(新的引用), 子节点和闭包环境一起搬出来
+lval *lval_promote(lval *v)
+{
+  if (!larena_has(v))
+    return lval_ref(v);
+  int on = larena_on;
+  larena_on = 0;
+  lval *x = lval_copy(v);
+  switch (x->type)
+  {
+  case LVAL_FUN:
+    if (!x->buildin)
+    {
+      lval_del(x->formals);
+      lval_del(x->body);
+      x->formals = lval_promote(v->formals);
+      x->body = lval_promote(v->body);
+      if (x->env)
+      {
+        lenv *env = lenv_copy(x->env);
+        FORLESS(env->count)
+        {
+          lval *y = lval_promote(env->vals[i]);
+          lval_del(env->vals[i]);
+          env->vals[i] = y;
+        }
+        env->pair = NULL;
+        env->temp = 0;
+        lenv_del(x->env);
+        x->env = env;
+      }
+    }
+    break;
+  case LVAL_SEXPR:
+  case LVAL_QEXPR:
+    FORLESS(x->count)
+    {
+      if (larena_has(x->cell[i]))
+      {
+        lbuf *b = lbuf_new(x->count);
+        b->used = x->count;
+        FORLESS(x->count)
+        {
+          b->items[i] = lval_promote(x->cell[i]);
+        }
+        lval_uncode(x);
+        lbuf_release(x->buf);
+        x->buf = b;
+        x->cell = b->items;
+        break;
+      }
+    }
+    break;
+  }
+  larena_on = on;
+  return x;
+}
+lval *lenv_lookup(lenv *e, int sym)
+{
+  uint64_t bit = LENV_BIT(sym);
+  for (; e; e = e->pair)
+  {
+    if (!(e->mask & bit))
+      continue;
+    int i = lenv_find(e, sym);
+    if (i >= 0)
+      return lval_ref(e->vals[i]);
+  }
+  return lval_err("Unbound Function: %s", lsym_name(sym));
+}
+lval *lenv_get(lenv *e, lval *k)
+{
+  return lenv_lookup(e, k->sym);
+}
+void lenv_bind(lenv *e, int sym, lval *v)
+{
+  // 全局环境等活得比这条语句久, 不能指向 arena
+  v = larena_on && !e->temp ? lval_promote(v) : lval_ref(v);
+  if (e == lenv_root)
+    lenv_version++;
+  int i = lenv_find(e, sym);
+  if (i >= 0)
+  {
+    lval *old = e->vals[i];
+    if (e == lenv_root && LVAL_TYPE(old) == LVAL_FUN && old->buildin && old->binop)
+      lenv_fold_version++;
+    lval_del(e->vals[i]); // 删除之前节点
+    e->vals[i] = v;
+    lgc_write(e);
+    return;
+  }
+  if (e->count == e->cap)
+  {
+    e->cap = e->cap ? e->cap * 2 : 4;
+    e->syms = realloc(e->syms, sizeof(int) * e->cap);
+    e->vals = reallocf(e->vals, sizeof(lval *) * e->cap);
+  }
+  e->vals[e->count] = v;
+  e->syms[e->count] = sym;
+  e->count++;
+  e->mask |= LENV_BIT(sym);
+  if (e != lenv_root)
+    lsyms[sym].shadow++;
+  lgc_write(e);
+  if (e->index || e->count > LENV_INDEX_MIN)
+  {
+    if (e->count * 2 >= e->index_cap)
+    {
+      lenv_index(e);
+      return;
+    }
+    unsigned slot = lenv_slot(sym, e->index_cap);
+    while (e->index[slot])
+      slot = (slot + 1) & (e->index_cap - 1);
+    e->index[slot] = e->count;
+  }
+}
+void lenv_put(lenv *e, lval *k, lval *v)
+{
+  lenv_bind(e, k->sym, v);
+}
+void lenv_def(lenv *e, lval *k, lval *v)
+{
+  while (e->pair)
+  {
+    e = e->pair;
+  }
+  lenv_put(e, k, v);
+}
+
+// 追踪式垃圾回收 (--gc=marksweep / --gc=gen)
+// 根: 全局环境 + C 栈 (求值过程中的临时值都在栈上, 保守扫描)
+// gc 模式下 lval_del/lenv_del 不做任何事, 回收全部交给这里
+// 分代模式: 新分配的对象在新生代, minor 回收只扫新生代,
+// 老对象被写入新指针时通过 lgc_write 记到 remembered set 里
+#if defined(__SANITIZE_ADDRESS__)
+#define LGC_NO_ASAN __attribute__((no_sanitize_address))
+#else
+#define LGC_NO_ASAN
+#endif
+typedef struct lptrs
+{
+  int count;
+  int cap;
+  void **items;
+} lptrs;
+void lptrs_push(lptrs *a, void *x)
+{
+  if (a->count == a->cap)
+  {
+    a->cap = a->cap ? a->cap * 2 : 256;
+    a->items = realloc(a->items, sizeof(void *) * a->cap);
+  }
+  a->items[a->count++] = x;
+}
+
+double lgc_growth = 2.0;   // 回收后堆增长到存活对象的多少倍再回收
+long lgc_nursery = 8192;   // 新生代对象数达到多少触发 minor 回收
+long lgc_min_heap = 16384; // 至少分配这么多对象才开始回收
+long lgc_threshold = 16384;
+lenv *lgc_root_env = NULL;
+char *lgc_stack_base = NULL;
+int lgc_running = 0;
+lptrs lgc_young;      // 新生代对象
+lptrs lgc_remembered; // 指向新生代的老对象
+lptrs lgc_gray;       // 标记栈, 避免递归太深
+lchunk **lgc_chunks = NULL;
+int lgc_nchunks = 0;
+int lgc_minor = 0; // 当前这次是否 minor 回收
+long lgc_minor_count = 0;
+long lgc_major_count = 0;
+long lgc_allocated = 0;
+long lgc_freed = 0;
+double lgc_pause = 0;
+
+long lgc_heap_live()
+{
+  return lval_pool.live + lenv_pool.live;
+}
+void lgc_track(lpool *p, void *x)
+{
+  memset(x, 0, p->size);
+  lchunk *c = LCHUNK_OF(x);
+  lchunk_setbit(c, LBIT_LIVE, lchunk_index(c, x), 1);
+  lgc_allocated++;
+  if (lgc_mode == LGC_GEN)
+    lptrs_push(&lgc_young, x);
+}
+void lgc_write(void *x)
+{
+  if (lgc_mode != LGC_GEN)
+    return;
+  lchunk *c = LCHUNK_OF(x);
+  int i = lchunk_index(c, x);
+  if (lchunk_bit(c, LBIT_OLD, i) && !lchunk_bit(c, LBIT_REMEMBERED, i))
+  {
+    lchunk_setbit(c, LBIT_REMEMBERED, i, 1);
+    lptrs_push(&lgc_remembered, x);
+  }
+}
+void lgc_mark(void *x)
+{
+  if (x == NULL || LVAL_IS_IMM(x))
+    return;
+  lchunk *c = LCHUNK_OF(x);
+  int i = lchunk_index(c, x);
+  if (lchunk_bit(c, LBIT_MARK, i))
+    return;
+  // minor 回收不进入老年代
+  if (lgc_minor && lchunk_bit(c, LBIT_OLD, i))
+    return;
+  lchunk_setbit(c, LBIT_MARK, i, 1);
+  lptrs_push(&lgc_gray, x);
+}
+void lgc_trace(void *x)
+{
+  if (LCHUNK_OF(x)->pool == &lenv_pool)
+  {
+    lenv *e = x;
+    lgc_mark(e->pair);
+    FORLESS(e->count)
+    {
+      lgc_mark(e->vals[i]);
+    }
+    return;
+  }
+  lval *v = x;
+  switch (v->type)
+  {
+  case LVAL_FUN:
+    if (!v->buildin)
+    {
+      lgc_mark(v->env);
+      lgc_mark(v->formals);
+      lgc_mark(v->body);
+    }
+    break;
+  case LVAL_MEMO:
+    lmemo_mark(v->memo);
+    break;
+  case LVAL_SEXPR:
+  case LVAL_QEXPR:
+    FORLESS(v->count)
+    {
+      lgc_mark(v->cell[i]);
+    }
+    break;
+  }
+}
+void lgc_drain()
+{
+  while (lgc_gray.count)
+  {
+    lgc_trace(lgc_gray.items[--lgc_gray.count]);
+  }
+}
+void lgc_collect_chunks()
+{
+  lgc_nchunks = 0;
+  lgc_chunks = realloc(lgc_chunks, sizeof(lchunk *) * (lval_pool.nchunks + lenv_pool.nchunks));
+  for (lchunk *c = lval_pool.chunks; c; c = c->next)
+    lgc_chunks[lgc_nchunks++] = c;
+  for (lchunk *c = lenv_pool.chunks; c; c = c->next)
+    lgc_chunks[lgc_nchunks++] = c;
+  qsort(lgc_chunks, lgc_nchunks, sizeof(lchunk *), lchunk_cmp);
+}
+// 栈上的一个字是不是指向某个已分配的 slot
+void lgc_mark_word(uintptr_t w)
+{
+  lchunk *c = LCHUNK_OF(w);
+  if (lgc_nchunks == 0 || (uintptr_t)c < (uintptr_t)lgc_chunks[0])
+    return;
+  if (lgc_chunks[lchunk_find(lgc_chunks, lgc_nchunks, c)] != c)
+    return;
+  char *first = lpool_slot(c, c->pool, 0);
+  if (w < (uintptr_t)first)
+    return;
+  int i = lchunk_index(c, (void *)w);
+  if (i >= lpool_slots(c->pool) || !lchunk_bit(c, LBIT_LIVE, i))
+    return;
+  lgc_mark(lpool_slot(c, c->pool, i));
+}
+LGC_NO_ASAN void lgc_mark_stack()
+{
+  // setjmp 把寄存器里的指针也存到栈上
+  jmp_buf regs;
+  setjmp(regs);
+  uintptr_t lo = (uintptr_t)&regs & ~(uintptr_t)(sizeof(void *) - 1);
+  for (uintptr_t p = lo; p < (uintptr_t)lgc_stack_base; p += sizeof(void *))
+  {
+    lgc_mark_word(*(uintptr_t *)p);
+  }
+}
+void lgc_sweep_pool(lpool *p)
+{
+  for (lchunk *c = p->chunks; c; c = c->next)
+  {
+    int slots = lpool_slots(p);
+    FORLESS(slots)
+    {
+      if (!lchunk_bit(c, LBIT_LIVE, i))
+        continue;
+      if (lchunk_bit(c, LBIT_MARK, i))
+      {
+        lchunk_setbit(c, LBIT_MARK, i, 0);
+        lchunk_setbit(c, LBIT_OLD, i, 1);
+        continue;
+      }
+      void *x = lpool_slot(c, p, i);
+      if (p == &lenv_pool)
+        lenv_free(x);
+      else
+        lval_free(x);
+      lgc_freed++;
+    }
+  }
+}
+// minor 回收只清理新生代链表里的对象, 活下来的晋升
+void lgc_sweep_young()
+{
+  FORLESS(lgc_young.count)
+  {
+    void *x = lgc_young.items[i];
+    lchunk *c = LCHUNK_OF(x);
+    int k = lchunk_index(c, x);
+    if (!lchunk_bit(c, LBIT_LIVE, k))
+      continue;
+    if (lchunk_bit(c, LBIT_MARK, k))
+    {
+      lchunk_setbit(c, LBIT_MARK, k, 0);
+      lchunk_setbit(c, LBIT_OLD, k, 1);
+      continue;
+    }
+    if (c->pool == &lenv_pool)
+      lenv_free(x);
+    else
+      lval_free(x);
+    lgc_freed++;
+  }
+}
+void lgc_collect(int minor)
+{
+  if (lgc_running)
+    return;
+  lgc_running = 1;
+  clock_t start = clock();
+  lgc_minor = minor;
+  lgc_collect_chunks();
+
+  lgc_mark(lgc_root_env);
+  lgc_mark_stack();
+  FORLESS(lvm_sp)
+  {
+    lgc_mark_word((uintptr_t)lvm_stack[i]);
+  }
+  FORLESS(lvm_nframes)
+  {
+    lgc_mark(lvm_frames[i].e);
+    lgc_mark(lvm_frames[i].src);
+  }
+  if (minor)
+  {
+    FORLESS(lgc_remembered.count)
+    {
+      lgc_trace(lgc_remembered.items[i]);
+    }
+  }
+  lgc_drain();
+
+  if (minor)
+  {
+    lgc_sweep_young();
+    lgc_minor_count++;
+  }
+  else
+  {
+    lgc_sweep_pool(&lval_pool);
+    lgc_sweep_pool(&lenv_pool);
+    lgc_major_count++;
+  }
+  // 活下来的都进了老年代, 老->新的指针也就不存在了
+  FORLESS(lgc_remembered.count)
+  {
+    lchunk *c = LCHUNK_OF(lgc_remembered.items[i]);
+    lchunk_setbit(c, LBIT_REMEMBERED, lchunk_index(c, lgc_remembered.items[i]), 0);
+  }
+  lgc_remembered.count = 0;
+  lgc_young.count = 0;
+
+  if (!minor)
+  {
+    lgc_threshold = lgc_heap_live() * lgc_growth;
+    if (lgc_threshold < lgc_min_heap)
+      lgc_threshold = lgc_min_heap;
+  }
+  lgc_pause += (double)(clock() - start) / CLOCKS_PER_SEC;
+  lgc_running = 0;
+}
+void lgc_maybe_collect()
+{
+  if (lgc_mode == LGC_GEN && lgc_young.count >= lgc_nursery)
+    lgc_collect(1);
+  if (lgc_heap_live() >= lgc_threshold)
+    lgc_collect(0);
+}
+
+lval *lval_read(mpc_ast_t *t);
+lval *lval_expr_read(mpc_ast_t *t)
+{
+  lval *x;
+  if (strcmp(t->tag, ">") == 0)
+  {
+    x = lval_sexpr();
+  }
+  if (strstr(t->tag, "sexpr"))
+  {
+    x = lval_sexpr();
+  }
+  if (strstr(t->tag, "qexpr"))
+  {
+    x = lval_qexpr();
+  }
+
+  FORLESS(t->children_num)
+  {
+    if (strcmp(t->children[i]->contents, "(") == 0)
+      continue;
+    if (strcmp(t->children[i]->contents, ")") == 0)
+      continue;
+    if (strcmp(t->children[i]->contents, "{") == 0)
+      continue;
+    if (strcmp(t->children[i]->contents, "}") == 0)
+      continue;
+    if (strcmp(t->children[i]->tag, "regex") == 0)
+      continue;
+    if (strstr(t->children[i]->tag, "comment"))
+      continue;
+    x = lval_add(x, lval_read(t->children[i]));
+  }
+  return x;
+}
+lval *lval_read(mpc_ast_t *t)
+{
+  if (strstr(t->tag, "number"))
+  {
+    return lval_check_num(t->contents);
+  }
+  if (strstr(t->tag, "double"))
+  {
+    return lval_check_dbl(t->contents);
+  }
+  if (strstr(t->tag, "symbol"))
+  {
+    return lval_sym(t->contents);
+  }
+  if (strstr(t->tag, "string"))
+  {
+    return lval_check_string(t->contents);
+  }
+
+  return lval_expr_read(t);
+}
+
+// 直接从源码读出 lval, 不生成 mpc_ast_t. 词法和 main 里的文法一致,
+// 按 double, number, symbol, string, comment, sexpr, qexpr 的顺序尝试
+int lread_mpc = 0; // --reader=mpc 时仍走上面的 mpc 路径
+typedef struct lreader
+{
+  char *name; // 报错时的来源名
+  char *src;
+  char *p;
+  lval *err;
+  int depth; // 当前嵌套了几层括号
+} lreader;
+#define LREAD_MAX_DEPTH 1000 // 和 mpc 的 MPC_MAX_RECURSION_DEPTH 一样, 免得嵌套太深把 C 栈用完
+#define LREAD_DIGIT(c) ((c) >= '0' && (c) <= '9')
+char *lread_digits(char *p)
+{
+  if (!LREAD_DIGIT(*p))
+    return NULL;
+  while (LREAD_DIGIT(*p))
+    p++;
+  return p;
+}
+// [eE][-+]?[0-9]+
+char *lread_exp(char *p)
+{
+  if (*p != 'e' && *p != 'E')
+    return NULL;
+  p++;
+  if (*p == '-' || *p == '+')
+    p++;
+  return lread_digits(p);
+}
+// double 的正则, 不匹配时返回 NULL, 否则返回结尾
+char *lread_double(char *p)
+{
+  if (*p == '-')
+    p++;
+  char *d = lread_digits(p);
+  if (!d)
+    return NULL;
+  if (*d == '.' && LREAD_DIGIT(d[1]))
+  {
+    char *f = lread_digits(d + 1);
+    char *x = lread_exp(f);
+    return x ? x : f;
+  }
+  return lread_exp(d);
+}
+int lread_symc(char c)
+{
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || LREAD_DIGIT(c) ||
+         (c && strchr("_+-*/\\=<>!&", c));
+}
+// 临时把结尾改成 '\0', 省掉一次复制
+lval *lread_token(char *s, char *end, lval *(*make)(char *))
+{
+  char c = *end;
+  *end = '\0';
+  lval *x = make(s);
+  *end = c;
+  return x;
+}
+// expect 为 NULL 时是嵌套太深
+lval *lread_fail(lreader *r, char *expect)
+{
+  int row = 1, col = 1;
+  for (char *q = r->src; q < r->p; q++)
+  {
+    if (*q == '\n')
+    {
+      row++;
+      col = 1;
+    }
+    else
+      col++;
+  }
+  if (expect == NULL)
+    r->err = lval_err("%s:%i:%i: error: Maximum recursion depth exceeded!", r->name, row, col);
+  else if (*r->p)
+    r->err = lval_err("%s:%i:%i: error: expected %s at '%c'", r->name, row, col, expect, *r->p);
+  else
+    r->err = lval_err("%s:%i:%i: error: expected %s at end of input", r->name, row, col, expect);
+  return NULL;
+}
+// 读到 close 为止, 元素加到 x 里; 出错时返回 NULL, 错误在 r->err
+lval *lread_expr(lreader *r, lval *x, char close)
+{
+  while (1)
+  {
+    char *p = r->p;
+    while (isspace((unsigned char)*p))
+      p++;
+    r->p = p;
+    if (*p == close)
+    {
+      if (close)
+        r->p++;
+      return x;
+    }
+    char *q;
+    lval *a;
+    if ((q = lread_double(p)))
+      a = lread_token(p, q, lval_check_dbl);
+    else if ((q = lread_digits(p + (*p == '-'))))
+      a = lread_token(p, q, lval_check_num);
+    else if (lread_symc(*p))
+    {
+      for (q = p + 1; lread_symc(*q); q++)
+        ;
+      a = lread_token(p, q, lval_sym);
+    }
+    else if (*p == '"')
+    {
+      for (q = p + 1; *q && *q != '"'; q++)
+        if (*q == '\\' && q[1])
+          q++;
+      if (!*q)
+      {
+        lval_del(x);
+        r->p = q;
+        return lread_fail(r, "'\"'");
+      }
+      a = lval_strn(p + 1, q - p - 1);
+      q++;
+    }
+    else if (*p == ';')
+    {
+      r->p = p + strcspn(p, "\r\n");
+      continue;
+    }
+    else if (*p == '(' || *p == '{')
+    {
+      if (r->depth == LREAD_MAX_DEPTH)
+      {
+        lval_del(x);
+        return lread_fail(r, NULL);
+      }
+      r->p = p + 1;
+      r->depth++;
+      a = *p == '(' ? lread_expr(r, lval_sexpr(), ')') : lread_expr(r, lval_qexpr(), '}');
+      r->depth--;
+      if (!a)
+      {
+        lval_del(x);
+        return NULL;
+      }
+      q = r->p;
+    }
+    else
+    {
+      lval_del(x);
+      return lread_fail(r, close == ')' ? "expression or ')'" : close == '}' ? "expression or '}'" : "expression or end of input");
+    }
+    x = lval_add(x, a);
+    r->p = q;
+  }
+}
+// 读出整段源码, 成功时返回顶层的 sexpr, 否则返回错误
+lval *lval_read_src(char *name, char *src)
+{
+  lreader r = {name, src, src, NULL, 0};
+  lval *x = lread_expr(&r, lval_sexpr(), '\0');
+  return x ? x : r.err;
+}
+// 和 mpc_parse_contents 一样读出整个文件
+lval *lval_read_file(char *name)
+{
+  if (lread_mpc)
+  {
+    mpc_result_t r;
+    if (mpc_parse_contents(name, Lispy, &r))
+    {
+      lval *x = lval_read(r.output);
+      mpc_ast_delete(r.output);
+      return x;
+    }
+    char *err_msg = mpc_err_string(r.error);
+    mpc_err_delete(r.error);
+    lval *err = lval_err(err_msg);
+    free(err_msg);
+    return err;
+  }
+  FILE *f = fopen(name, "rb");
+  if (!f)
+    return lval_err("%s: error: Unable to open file!\n", name);
+  fseek(f, 0, SEEK_END);
+  long n = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  char *src = malloc(n + 1);
+  src[fread(src, 1, n, f)] = '\0';
+  fclose(f);
+  lval *x = lval_read_src(name, src);
+  free(src);
+  return x;
+}
+
+lval *buildin_head(lenv *e, lval *v)
+{
+  LASSERT_NUM("head", v, 1);
+  LASSERT_TYPE("head", v, 0, LVAL_QEXPR);
+  LASSERT_NOT_EMPTY("head", v, 0);
+  lval *x = lval_add(lval_qexpr(), lval_ref(v->cell[0]->cell[0]));
+  lval_del(v);
+  return x;
+}
+lval *buildin_tail(lenv *e, lval *v)
+{
+  LASSERT_NUM("tail", v, 1);
+  LASSERT_TYPE("tail", v, 0, LVAL_QEXPR);
+  LASSERT_NOT_EMPTY("tail", v, 0);
+  lval *x = lval_own(lval_take(v, 0));
+  lval_del(lval_pop(x, 0));
+  return x;
+}
+lval *buildin_list(lenv *e, lval *v)
+{
+  v->type = LVAL_QEXPR;
+  return v;
+}
+lval *buildin_eval(lenv *e, lval *v)
+{
+  LASSERT_NUM("eval", v, 1);
+  LASSERT_TYPE("eval", v, 0, LVAL_QEXPR);
+  lval *x = lval_own(lval_take(v, 0));
+  x->type = LVAL_SEXPR;
+  return lval_eval(e, x);
+}
+// 拼接两个列表, 尽量在已有的 lbuf 上原地完成:
+// x 在 lbuf 末尾且有空间就往后追加, y 独占 lbuf 且前面有空位就往前放,
+// 都不行才分配新的 lbuf, 并在前后都留出空间给之后的拼接
+lval *lval_join(lval *x, lval *y)
+{
+  if (y->count == 0)
+  {
+    lval_del(y);
+    return x;
+  }
+  if (x->count == 0)
+  {
+    lval_del(x);
+    return y;
+  }
+  if (y->rc == 1 && lval_exclusive(y) && lval_start(y) >= x->count)
+  {
+    lval_uncode(y);
+    y->cell -= x->count;
+    y->buf->lo -= x->count;
+    FORLESS(x->count)
+    {
+      y->cell[i] = lval_ref(x->cell[i]);
+    }
+    y->count += x->count;
+    lgc_write(y);
+    lval_del(x);
+    return y;
+  }
+  x = lval_own(x);
+  lval_uncode(x);
+  int total = x->count + y->count;
+  if (!(x->buf && lval_start(x) + x->count == x->buf->used && lval_start(x) + total <= x->buf->cap))
+    lval_rebuf(x, total + total / 2, total / 2);
+  FORLESS(y->count)
+  {
+    x->cell[x->count++] = lval_ref(y->cell[i]);
+  }
+  x->buf->used += y->count;
+  lgc_write(x);
+  lval_del(y);
+  return x;
+}
+lval *buildin_join(lenv *e, lval *v)
+{
+  FORLESS(v->count)
+  {
+    LASSERT_TYPE("join", v, i, LVAL_QEXPR);
+  }
+  lval *x = lval_pop(v, 0);
+  while (v->count)
+  {
+    x = lval_join(x, lval_pop(v, 0));
+  }
+  lval_del(v);
+  return x;
+}
+// 向量运算的内核: out[i] = a[i] op b[i], sa / sb 为 0 时对应的一边是标量 (只有 [0]), 广播到每个元素
+// 返回 0 成功, 1 整数溢出, 2 除以 0. 比较的结果是 0 / 1 组成的整数向量
+// 每个运算有一个普通 C 版本, 能用 AVX2 的再写一个, 启动时选 (x86-64 上普通版本本身会被编译成 SSE2)
+enum
+{
+  LVEC_ADD,
+  LVEC_SUB,
+  LVEC_MUL,
+  LVEC_DIV,
+  LVEC_GT,
+  LVEC_GE,
+  LVEC_LT,
+  LVEC_LE,
+  LVEC_NOPS
+};
+typedef int (*lvec_kernel)(void *out, const void *a, int sa, const void *b, int sb, long n);
+#define LVEC_C_KERNEL(name, T, R, body)                                                 \
+  int lvec_c_##name(void *out, const void *pa, int sa, const void *pb, int sb, long n) \
+  {                                                                                    \
+    const T *a = pa, *b = pb;                                                          \
+    R *o = out;                                                                        \
+    int err = 0;                                                                       \
+    for (long i = 0; i < n; i++)                                                       \
+    {                                                                                  \
+      T x = a[i * sa], y = b[i * sb];                                                  \
+      body;                                                                            \
+    }                                                                                  \
+    return err;                                                                        \
+  }
+LVEC_C_KERNEL(dadd, double, double, o[i] = x + y)
+LVEC_C_KERNEL(dsub, double, double, o[i] = x - y)
+LVEC_C_KERNEL(dmul, double, double, o[i] = x * y)
+LVEC_C_KERNEL(ddiv, double, double, o[i] = x / y)
+LVEC_C_KERNEL(dgt, double, long, o[i] = x > y)
+LVEC_C_KERNEL(dge, double, long, o[i] = x >= y)
+LVEC_C_KERNEL(dlt, double, long, o[i] = x < y)
+LVEC_C_KERNEL(dle, double, long, o[i] = x <= y)
+LVEC_C_KERNEL(iadd, long, long, err |= __builtin_add_overflow(x, y, &o[i]))
+LVEC_C_KERNEL(isub, long, long, err |= __builtin_sub_overflow(x, y, &o[i]))
+LVEC_C_KERNEL(imul, long, long, err |= __builtin_mul_overflow(x, y, &o[i]))
+LVEC_C_KERNEL(idiv, long, long, if (y == 0) err |= 2; else if (x == LONG_MIN && y == -1) err |= 1; else o[i] = x / y)
+LVEC_C_KERNEL(igt, long, long, o[i] = x > y)
+LVEC_C_KERNEL(ige, long, long, o[i] = x >= y)
+LVEC_C_KERNEL(ilt, long, long, o[i] = x < y)
+LVEC_C_KERNEL(ile, long, long, o[i] = x <= y)
+#ifdef LVEC_AVX2
+// 每次处理 4 个元素, 剩下的不满 4 个交给 C 版本
+#define LVEC_AVX __attribute__((target("avx2")))
+#define LVEC_LOADD(p, s, i) ((s) ? _mm256_loadu_pd((p) + (i)) : _mm256_set1_pd((p)[0]))
+#define LVEC_LOADI(p, s, i) ((s) ? _mm256_loadu_si256((const __m256i *)((p) + (i))) : _mm256_set1_epi64x((p)[0]))
+#define LVEC_TAIL(name) err | lvec_c_##name(o + i, a + i * sa, sa, b + i * sb, sb, n - i)
+#define LVEC_AVX_KERNEL(name, T, R, body)                                                          \
+  LVEC_AVX int lvec_avx_##name(void *out, const void *pa, int sa, const void *pb, int sb, long n) \
+  {                                                                                               \
+    const T *a = pa, *b = pb;                                                                     \
+    R *o = out;                                                                                   \
+    const __m256i one = _mm256_set1_epi64x(1);                                                    \
+    __m256i ovf = _mm256_setzero_si256();                                                         \
+    long i = 0;                                                                                   \
+    for (; i + 4 <= n; i += 4)                                                                    \
+    {                                                                                             \
+      body;                                                                                       \
+    }                                                                                             \
+    (void)one;                                                                                    \
+    int err = _mm256_movemask_pd(_mm256_castsi256_pd(ovf)) != 0;                                  \
+    return LVEC_TAIL(name);                                                                       \
+  }
+#define LVEC_AVX_DOP(op) _mm256_storeu_pd(o + i, op(LVEC_LOADD(a, sa, i), LVEC_LOADD(b, sb, i)))
+#define LVEC_AVX_DCMP(pred) _mm256_storeu_si256((__m256i *)(o + i), _mm256_and_si256(one, _mm256_castpd_si256(_mm256_cmp_pd(LVEC_LOADD(a, sa, i), LVEC_LOADD(b, sb, i), pred))))
+LVEC_AVX_KERNEL(dadd, double, double, LVEC_AVX_DOP(_mm256_add_pd))
+LVEC_AVX_KERNEL(dsub, double, double, LVEC_AVX_DOP(_mm256_sub_pd))
+LVEC_AVX_KERNEL(dmul, double, double, LVEC_AVX_DOP(_mm256_mul_pd))
+LVEC_AVX_KERNEL(ddiv, double, double, LVEC_AVX_DOP(_mm256_div_pd))
+LVEC_AVX_KERNEL(dgt, double, long, LVEC_AVX_DCMP(_CMP_GT_OQ))
+LVEC_AVX_KERNEL(dge, double, long, LVEC_AVX_DCMP(_CMP_GE_OQ))
+LVEC_AVX_KERNEL(dlt, double, long, LVEC_AVX_DCMP(_CMP_LT_OQ))
+LVEC_AVX_KERNEL(dle, double, long, LVEC_AVX_DCMP(_CMP_LE_OQ))
+// 溢出: 加法两个操作数和结果符号不同, 减法两个操作数符号不同且结果和被减数符号不同; 最后看符号位
+LVEC_AVX_KERNEL(iadd, long, long, __m256i x = LVEC_LOADI(a, sa, i); __m256i y = LVEC_LOADI(b, sb, i); __m256i r = _mm256_add_epi64(x, y);
+                ovf = _mm256_or_si256(ovf, _mm256_and_si256(_mm256_xor_si256(x, r), _mm256_xor_si256(y, r)));
+                _mm256_storeu_si256((__m256i *)(o + i), r))
+LVEC_AVX_KERNEL(isub, long, long, __m256i x = LVEC_LOADI(a, sa, i); __m256i y = LVEC_LOADI(b, sb, i); __m256i r = _mm256_sub_epi64(x, y);
+                ovf = _mm256_or_si256(ovf, _mm256_and_si256(_mm256_xor_si256(x, y), _mm256_xor_si256(x, r)));
+                _mm256_storeu_si256((__m256i *)(o + i), r))
+// AVX2 只有 64 位的大于比较, 其余用交换和取反得到
+#define LVEC_AVX_ICMP(x, y, f) _mm256_storeu_si256((__m256i *)(o + i), f(_mm256_cmpgt_epi64(LVEC_LOADI(x, s##x, i), LVEC_LOADI(y, s##y, i)), one))
+LVEC_AVX_KERNEL(igt, long, long, LVEC_AVX_ICMP(a, b, _mm256_and_si256))
+LVEC_AVX_KERNEL(ige, long, long, LVEC_AVX_ICMP(b, a, _mm256_andnot_si256))
+LVEC_AVX_KERNEL(ilt, long, long, LVEC_AVX_ICMP(b, a, _mm256_and_si256))
+LVEC_AVX_KERNEL(ile, long, long, LVEC_AVX_ICMP(a, b, _mm256_andnot_si256))
+#endif
+// [是否用 AVX2][元素类型][运算], AVX2 没有 64 位整数乘除, 用 C 版本
+lvec_kernel lvec_kernels[2][2][LVEC_NOPS] = {
+    {{lvec_c_iadd, lvec_c_isub, lvec_c_imul, lvec_c_idiv, lvec_c_igt, lvec_c_ige, lvec_c_ilt, lvec_c_ile},
+     {lvec_c_dadd, lvec_c_dsub, lvec_c_dmul, lvec_c_ddiv, lvec_c_dgt, lvec_c_dge, lvec_c_dlt, lvec_c_dle}},
+#ifdef LVEC_AVX2
+    {{lvec_avx_iadd, lvec_avx_isub, lvec_c_imul, lvec_c_idiv, lvec_avx_igt, lvec_avx_ige, lvec_avx_ilt, lvec_avx_ile},
+     {lvec_avx_dadd, lvec_avx_dsub, lvec_avx_dmul, lvec_avx_ddiv, lvec_avx_dgt, lvec_avx_dge, lvec_avx_dlt, lvec_avx_dle}},
+#endif
+};
+int lvec_simd = 0; // CPU 支持 AVX2 时 main 里设为 1, --no-simd 时保持 0
+
+// 归约: sum / min / max 和点积, 结果写进 out (long 或 double), 返回 1 表示整数溢出
+enum
+{
+  LVEC_SUM,
+  LVEC_MIN,
+  LVEC_MAX,
+  LVEC_DOT,
+  LVEC_NREDS
+};
+typedef int (*lvec_reducer)(const void *a, const void *b, long n, void *out);
+int lvec_c_dsum(const void *pa, const void *pb, long n, void *out)
+{
+  const double *a = pa;
+  double s = 0;
+  for (long i = 0; i < n; i++)
+    s += a[i];
+  *(double *)out = s;
+  return 0;
+}
+int lvec_c_ddot(const void *pa, const void *pb, long n, void *out)
+{
+  const double *a = pa, *b = pb;
+  double s = 0;
+  for (long i = 0; i < n; i++)
+    s += a[i] * b[i];
+  *(double *)out = s;
+  return 0;
+}
+int lvec_c_dmin(const void *pa, const void *pb, long n, void *out)
+{
+  const double *a = pa;
+  double m = a[0];
+  for (long i = 1; i < n; i++)
+    m = m < a[i] ? m : a[i];
+  *(double *)out = m;
+  return 0;
+}
+int lvec_c_dmax(const void *pa, const void *pb, long n, void *out)
+{
+  const double *a = pa;
+  double m = a[0];
+  for (long i = 1; i < n; i++)
+    m = m > a[i] ? m : a[i];
+  *(double *)out = m;
+  return 0;
+}
+int lvec_c_isum(const void *pa, const void *pb, long n, void *out)
+{
+  const long *a = pa;
+  long s = 0;
+  for (long i = 0; i < n; i++)
+  {
+    if (__builtin_add_overflow(s, a[i], &s))
+      return 1;
+  }
+  *(long *)out = s;
+  return 0;
+}
+int lvec_c_idot(const void *pa, const void *pb, long n, void *out)
+{
+  const long *a = pa, *b = pb;
+  long s = 0, p;
+  for (long i = 0; i < n; i++)
+  {
+    if (__builtin_mul_overflow(a[i], b[i], &p) || __builtin_add_overflow(s, p, &s))
+      return 1;
+  }
+  *(long *)out = s;
+  return 0;
+}
+int lvec_c_imin(const void *pa, const void *pb, long n, void *out)
+{
+  const long *a = pa;
+  long m = a[0];
+  for (long i = 1; i < n; i++)
+    m = m < a[i] ? m : a[i];
+  *(long *)out = m;
+  return 0;
+}
+int lvec_c_imax(const void *pa, const void *pb, long n, void *out)
+{
+  const long *a = pa;
+  long m = a[0];
+  for (long i = 1; i < n; i++)
+    m = m > a[i] ? m : a[i];
+  *(long *)out = m;
+  return 0;
+}
+#ifdef LVEC_AVX2
+// 4 路分别累加, 最后合起来再加上不满 4 个的尾巴; 浮点数求和的顺序因此和 C 版本不同
+#define LVEC_AVX_REDUCE(name, T, V, init, body, combine)                     \
+  LVEC_AVX int lvec_avx_##name(const void *pa, const void *pb, long n, void *out) \
+  {                                                                          \
+    const T *a = pa, *b = pb;                                                \
+    if (n < 8)                                                               \
+      return lvec_c_##name(a, b, n, out);                                    \
+    V acc = init;                                                            \
+    __m256i ovf = _mm256_setzero_si256();                                    \
+    long i = 0;                                                              \
+    for (; i + 4 <= n; i += 4)                                               \
+    {                                                                        \
+      body;                                                                  \
+    }                                                                        \
+    if (_mm256_movemask_pd(_mm256_castsi256_pd(ovf)))                        \
+      return 1;                                                              \
+    T lane[4], r;                                                            \
+    _mm256_storeu_si256((__m256i *)lane, (__m256i)acc);                      \
+    r = lane[0];                                                             \
+    for (int k = 1; k < 4; k++)                                              \
+    {                                                                        \
+      combine(lane[k]);                                                      \
+    }                                                                        \
+    for (; i < n; i++)                                                       \
+    {                                                                        \
+      combine(a[i]);                                                         \
+    }                                                                        \
+    *(T *)out = r;                                                           \
+    (void)b;                                                                 \
+    return 0;                                                                \
+  }
+#define LVEC_RSUM(x) r += (x)
+#define LVEC_RMIN(x) r = r < (x) ? r : (x)
+#define LVEC_RMAX(x) r = r > (x) ? r : (x)
+#define LVEC_RISUM(x)                      \
+  if (__builtin_add_overflow(r, (x), &r)) \
+  return 1
+LVEC_AVX_REDUCE(dsum, double, __m256d, _mm256_setzero_pd(), acc = _mm256_add_pd(acc, _mm256_loadu_pd(a + i)), LVEC_RSUM)
+LVEC_AVX_REDUCE(dmin, double, __m256d, _mm256_loadu_pd(a), acc = _mm256_min_pd(acc, _mm256_loadu_pd(a + i)), LVEC_RMIN)
+LVEC_AVX_REDUCE(dmax, double, __m256d, _mm256_loadu_pd(a), acc = _mm256_max_pd(acc, _mm256_loadu_pd(a + i)), LVEC_RMAX)
+LVEC_AVX_REDUCE(isum, long, __m256i, _mm256_setzero_si256(), __m256i x = _mm256_loadu_si256((const __m256i *)(a + i)); __m256i r = _mm256_add_epi64(acc, x);
+                ovf = _mm256_or_si256(ovf, _mm256_and_si256(_mm256_xor_si256(acc, r), _mm256_xor_si256(x, r))); acc = r, LVEC_RISUM)
+// 没有 64 位的 min / max, 用比较结果选
+LVEC_AVX_REDUCE(imin, long, __m256i, _mm256_loadu_si256((const __m256i *)a), __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+                acc = _mm256_blendv_epi8(acc, x, _mm256_cmpgt_epi64(acc, x)), LVEC_RMIN)
+LVEC_AVX_REDUCE(imax, long, __m256i, _mm256_loadu_si256((const __m256i *)a), __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+                acc = _mm256_blendv_epi8(acc, x, _mm256_cmpgt_epi64(x, acc)), LVEC_RMAX)
+// 浮点数点积的尾巴要乘上 b, 单独写
+LVEC_AVX int lvec_avx_ddot(const void *pa, const void *pb, long n, void *out)
+{
+  const double *a = pa, *b = pb;
+  __m256d acc = _mm256_setzero_pd();
+  long i = 0;
+  for (; i + 4 <= n; i += 4)
+    acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+  double lane[4];
+  _mm256_storeu_pd(lane, acc);
+  double r = (lane[0] + lane[1]) + (lane[2] + lane[3]);
+  for (; i < n; i++)
+    r += a[i] * b[i];
+  *(double *)out = r;
+  return 0;
+}
+#endif
+// [是否用 AVX2][元素类型][归约], AVX2 没有 64 位整数乘法, 整数点积用 C 版本
+lvec_reducer lvec_reducers[2][2][LVEC_NREDS] = {
+    {{lvec_c_isum, lvec_c_imin, lvec_c_imax, lvec_c_idot},
+     {lvec_c_dsum, lvec_c_dmin, lvec_c_dmax, lvec_c_ddot}},
+#ifdef LVEC_AVX2
+    {{lvec_avx_isum, lvec_avx_imin, lvec_avx_imax, lvec_c_idot},
+     {lvec_avx_dsum, lvec_avx_dmin, lvec_avx_dmax, lvec_avx_ddot}},
+#endif
+};
+
+// 矩阵乘法 c (r x n) = a (r x k) b (k x n), 都按行排列, c 先清零
+// 分块: 每次只用 b 的 LMAT_KB 行 x LMAT_NB 列 (128KB, 留在 L2 里), a 的行一行行扫过去.
+// AVX2 版本每次在寄存器里算 c 的 4 行 x 8 列, 边上不满的部分和 C 版本一样逐个算;
+// 两个版本每个元素的乘加顺序相同 (没有用 FMA), 所以结果也相同
+#define LMAT_KB 128
+#define LMAT_NB 128
+void lmat_c_mul(const double *a, const double *b, double *c, long r, long k, long n)
+{
+  for (long kk = 0; kk < k; kk += LMAT_KB)
+  {
+    long ke = kk + LMAT_KB < k ? kk + LMAT_KB : k;
+    for (long jj = 0; jj < n; jj += LMAT_NB)
+    {
+      long je = jj + LMAT_NB < n ? jj + LMAT_NB : n;
+      for (long i = 0; i < r; i++)
+      {
+        for (long p = kk; p < ke; p++)
+        {
+          double x = a[i * k + p];
+          for (long j = jj; j < je; j++)
+            c[i * n + j] += x * b[p * n + j];
+        }
+      }
+    }
+  }
+}
+#ifdef LVEC_AVX2
+LVEC_AVX void lmat_avx_mul(const double *a, const double *b, double *c, long r, long k, long n)
+{
+  for (long kk = 0; kk < k; kk += LMAT_KB)
+  {
+    long ke = kk + LMAT_KB < k ? kk + LMAT_KB : k;
+    for (long jj = 0; jj < n; jj += LMAT_NB)
+    {
+      long je = jj + LMAT_NB < n ? jj + LMAT_NB : n;
+      long i = 0;
+      for (; i + 4 <= r; i += 4)
+      {
+        long j = jj;
+        for (; j + 8 <= je; j += 8)
+        {
+          __m256d acc[4][2];
+          for (int q = 0; q < 4; q++)
+          {
+            acc[q][0] = _mm256_loadu_pd(c + (i + q) * n + j);
+            acc[q][1] = _mm256_loadu_pd(c + (i + q) * n + j + 4);
+          }
+          for (long p = kk; p < ke; p++)
+          {
+            __m256d b0 = _mm256_loadu_pd(b + p * n + j);
+            __m256d b1 = _mm256_loadu_pd(b + p * n + j + 4);
+            for (int q = 0; q < 4; q++)
+            {
+              __m256d x = _mm256_set1_pd(a[(i + q) * k + p]);
+              acc[q][0] = _mm256_add_pd(acc[q][0], _mm256_mul_pd(x, b0));
+              acc[q][1] = _mm256_add_pd(acc[q][1], _mm256_mul_pd(x, b1));
+            }
+          }
+          for (int q = 0; q < 4; q++)
+          {
+            _mm256_storeu_pd(c + (i + q) * n + j, acc[q][0]);
+            _mm256_storeu_pd(c + (i + q) * n + j + 4, acc[q][1]);
+          }
+        }
+        for (; j < je; j++)
+        {
+          for (long q = i; q < i + 4; q++)
+          {
+            double s = c[q * n + j];
+            for (long p = kk; p < ke; p++)
+              s += a[q * k + p] * b[p * n + j];
+            c[q * n + j] = s;
+          }
+        }
+      }
+      for (; i < r; i++)
+      {
+        for (long p = kk; p < ke; p++)
+        {
+          double x = a[i * k + p];
+          for (long j = jj; j < je; j++)
+            c[i * n + j] += x * b[p * n + j];
+        }
+      }
+    }
+  }
+}
+#endif
+void (*lmat_muls[2])(const double *a, const double *b, double *c, long r, long k, long n) = {
+    lmat_c_mul,
+#ifdef LVEC_AVX2
+    lmat_avx_mul,
+#endif
+};
+// 转置也分块, 每次一个 LMAT_TB x LMAT_TB 的小块, 读写都留在缓存里
+#define LMAT_TB 32
+void lmat_transpose(const double *a, double *t, long r, long c)
+{
+  for (long ii = 0; ii < r; ii += LMAT_TB)
+  {
+    for (long jj = 0; jj < c; jj += LMAT_TB)
+    {
+      for (long i = ii; i < r && i < ii + LMAT_TB; i++)
+      {
+        for (long j = jj; j < c && j < jj + LMAT_TB; j++)
+          t[j * r + i] = a[i * c + j];
+      }
+    }
+  }
+}
+
+// 向量或者数字 (当作长度为 1 的向量) 的 lvec, 新的引用; 放不进 long 的整数返回 NULL
+lvec *lvec_of(lval *v)
+{
+  if (LVAL_IS_ARRAY(v))
+  {
+    v->vec->rc++;
+    return v->vec;
+  }
+  if (LVAL_TYPE(v) == LVAL_DBL)
+  {
+    lvec *x = lvec_new(LVEC_DBL, 1);
+    x->d[0] = LVAL_DBLV(v);
+    return x;
+  }
+  if (!LVAL_IS_LONG(v))
+    return NULL;
+  lvec *x = lvec_new(LVEC_INT, 1);
+  x->i[0] = LVAL_NUMV(v);
+  return x;
+}
+// 转成元素是 double 的向量, 接管 x
+lvec *lvec_to_dbl(lvec *x)
+{
+  if (x->kind == LVEC_DBL)
+    return x;
+  lvec *y = lvec_new(LVEC_DBL, x->n);
+  for (long i = 0; i < x->n; i++)
+    y->d[i] = (double)x->i[i];
+  lvec_release(x);
+  return y;
+}
+// a op b, 至少一个是向量 (或矩阵), 两个都是时长度 (行列数) 要相同; 有 double 时整数先转成 double
+// 参数借用, 不释放
+lval *lvec_binop(lval *a, lval *b, int op)
+{
+  if (!(LVAL_IS_NUMBER(a) || LVAL_IS_ARRAY(a)) || !(LVAL_IS_NUMBER(b) || LVAL_IS_ARRAY(b)))
+    return lval_err("buildin op operate on non-number!");
+  lvec *x = lvec_of(a);
+  lvec *y = lvec_of(b);
+  int sa = LVAL_IS_ARRAY(a), sb = LVAL_IS_ARRAY(b);
+  lval *err = NULL;
+  if (x == NULL || y == NULL)
+    err = lval_err("Vector element out of range!");
+  else if (sa && sb && LVAL_TYPE(a) != LVAL_TYPE(b))
+    err = lval_err("Can not operate on %s and %s!", ltype_name(LVAL_TYPE(a)), ltype_name(LVAL_TYPE(b)));
+  else if (sa && sb && LVAL_TYPE(a) == LVAL_MAT && (x->rows != y->rows || x->cols != y->cols))
+    err = lval_err("Matrix shape mismatch! Got %lix%li and %lix%li", x->rows, x->cols, y->rows, y->cols);
+  else if (sa && sb && x->n != y->n)
+    err = lval_err("Vector length mismatch! Got %li and %li", x->n, y->n);
+  if (err)
+  {
+    if (x)
+      lvec_release(x);
+    if (y)
+      lvec_release(y);
+    return err;
+  }
+  long n = sa ? x->n : y->n;
+  lval *shape = sa ? a : b;
+  int kind = LVEC_INT;
+  if (x->kind == LVEC_DBL || y->kind == LVEC_DBL)
+  {
+    kind = LVEC_DBL;
+    x = lvec_to_dbl(x);
+    y = lvec_to_dbl(y);
+  }
+  lvec *r = lvec_new(op >= LVEC_GT ? LVEC_INT : kind, n);
+  if (r == NULL)
+  {
+    lvec_release(x);
+    lvec_release(y);
+    return lval_err("Can not allocate vector of %li elements!", n);
+  }
+  int res = lvec_kernels[lvec_simd][kind][op](r->d, x->d, sa, y->d, sb, n);
+  lvec_release(x);
+  lvec_release(y);
+  if (res)
+  {
+    lvec_release(r);
+    return lval_err(res & 2 ? "Division By Zero!" : "Integer overflow in vector operation!");
+  }
+  if (LVAL_TYPE(shape) == LVAL_MAT)
+    return lval_mat(r, shape->vec->rows, shape->vec->cols);
+  return lval_vec(r);
+}
+// 四则运算各自一个函数, 参数类型只检查一遍, 在 long 上累加, 最后只生成一个结果
+// 溢出 (用编译器的带检查的运算判断) 或遇到大整数后改用 lbig 接着算, 遇到浮点数后改用 double
+#define LASSERT_NUMS(arg) LASSERT(arg, lval_all_num(arg), "buildin op operate on non-number!")
+int lval_all_num(lval *v)
+{
+  FORLESS(v->count)
+  {
+    if (!LVAL_IS_NUMBER(v->cell[i]))
+      return 0;
+  }
+  return 1;
+}
+lval *lval_vec_arith(lenv *e, lval *v, int op);
+// 用 double 把 v->cell[i..] 依次算进 acc, 释放 v
+lval *lval_dbl_fold(lval *v, int i, double acc, char op)
+{
+  for (; i < v->count; i++)
+  {
+    double y = lval_to_double(v->cell[i]);
+    switch (op)
+    {
+    case '+':
+      acc += y;
+      break;
+    case '-':
+      acc -= y;
+      break;
+    case '*':
+      acc *= y;
+      break;
+    default:
+      acc /= y;
+      break;
+    }
+  }
+  lval_del(v);
+  return lval_dbl(acc);
+}
+// 用大整数把 v->cell[i..] 依次算进 acc, 接管 acc, 释放 v
+lval *lval_big_fold(lval *v, int i, lbig *acc, char op)
+{
+  for (; i < v->count; i++)
+  {
+    if (LVAL_TYPE(v->cell[i]) == LVAL_DBL)
+    {
+      double x = lbig_to_double(acc);
+      lbig_release(acc);
+      return lval_dbl_fold(v, i, x, op);
+    }
+    lbig *y = lval_to_big(v->cell[i]);
+    lbig *r;
+    if (op == '/' && y->n == 0)
+    {
+      lbig_release(y);
+      lbig_release(acc);
+      lval_del(v);
+      return lval_err("Division By Zero!");
+    }
+    switch (op)
+    {
+    case '+':
+      r = lbig_add(acc, y, 0);
+      break;
+    case '-':
+      r = lbig_add(acc, y, 1);
+      break;
+    case '*':
+      r = lbig_mul(acc, y);
+      break;
+    default:
+      r = lbig_div(acc, y);
+      break;
+    }
+    lbig_release(y);
+    lbig_release(acc);
+    acc = r;
+  }
+  lval_del(v);
+  return lval_big(acc);
+}
+// v->cell[i] 不是 long 了, 已经算到 x
+lval *lval_wide_fold(lval *v, int i, long x, char op)
+{
+  if (LVAL_TYPE(v->cell[i]) == LVAL_DBL)
+    return lval_dbl_fold(v, i, (double)x, op);
+  return lval_big_fold(v, i, lbig_from_long(x), op);
+}
+// 第一个参数不是 long 时从它开始算
+lval *lval_wide_first(lval *v, char op)
+{
+  lval *x = v->cell[0];
+  if (LVAL_TYPE(x) == LVAL_DBL)
+    return lval_dbl_fold(v, 1, LVAL_DBLV(x), op);
+  return lval_big_fold(v, 1, lval_to_big(x), op);
+}
+lval *buildin_add(lenv *e, lval *v)
+{
+  if (!lval_all_num(v))
+    return lval_vec_arith(e, v, LVEC_ADD);
+  long x = 0, y;
+  FORLESS(v->count)
+  {
+    if (!LVAL_IS_LONG(v->cell[i]))
+      return lval_wide_fold(v, i, x, '+');
+    if (__builtin_add_overflow(x, LVAL_NUMV(v->cell[i]), &y))
+      return lval_big_fold(v, i, lbig_from_long(x), '+');
+    x = y;
+  }
+  lval_del(v);
+  return lval_num(x);
+}
+lval *buildin_sub(lenv *e, lval *v)
+{
+  if (!lval_all_num(v))
+    return lval_vec_arith(e, v, LVEC_SUB);
+  if (v->count == 1 && !LVAL_IS_LONG(v->cell[0]))
+  {
+    // 取负
+    if (LVAL_TYPE(v->cell[0]) == LVAL_DBL)
+    {
+      double x = -LVAL_DBLV(v->cell[0]);
+      lval_del(v);
+      return lval_dbl(x);
+    }
+    return lval_big_fold(v, 0, lbig_new(0), '-');
+  }
+  if (v->count && !LVAL_IS_LONG(v->cell[0]))
+    return lval_wide_first(v, '-');
+  long x = v->count ? LVAL_NUMV(v->cell[0]) : 0, y;
+  if (v->count == 1)
+  {
+    if (__builtin_sub_overflow(0, x, &y))
+      return lval_big_fold(v, 0, lbig_new(0), '-');
+    x = y;
+  }
+  for (int i = 1; i < v->count; i++)
+  {
+    if (!LVAL_IS_LONG(v->cell[i]))
+      return lval_wide_fold(v, i, x, '-');
+    if (__builtin_sub_overflow(x, LVAL_NUMV(v->cell[i]), &y))
+      return lval_big_fold(v, i, lbig_from_long(x), '-');
+    x = y;
+  }
+  lval_del(v);
+  return lval_num(x);
+}
+lval *buildin_mul(lenv *e, lval *v)
+{
+  if (!lval_all_num(v))
+    return lval_vec_arith(e, v, LVEC_MUL);
+  long x = 1, y;
+  FORLESS(v->count)
+  {
+    if (!LVAL_IS_LONG(v->cell[i]))
+      return lval_wide_fold(v, i, x, '*');
+    if (__builtin_mul_overflow(x, LVAL_NUMV(v->cell[i]), &y))
+      return lval_big_fold(v, i, lbig_from_long(x), '*');
+    x = y;
+  }
+  lval_del(v);
+  return lval_num(x);
+}
+lval *buildin_div(lenv *e, lval *v)
+{
+  if (!lval_all_num(v))
+    return lval_vec_arith(e, v, LVEC_DIV);
+  if (v->count && !LVAL_IS_LONG(v->cell[0]))
+    return lval_wide_first(v, '/');
+  long x = v->count ? LVAL_NUMV(v->cell[0]) : 0;
+  for (int i = 1; i < v->count; i++)
+  {
+    if (!LVAL_IS_LONG(v->cell[i]))
+      return lval_wide_fold(v, i, x, '/');
+    long y = LVAL_NUMV(v->cell[i]);
+    if (x == LONG_MIN && y == -1)
+      return lval_big_fold(v, i, lbig_from_long(x), '/');
+    LASSERT(v, y != 0, "Division By Zero!");
+    x /= y;
+  }
+  lval_del(v);
+  return lval_num(x);
+}
+// 两个参数时的快速版本 (lbinop), 字节码调用内建函数时直接用栈上的两个值,
+// 不用先装进一个 S-Expression. 参数借用, 不释放; 返回 NULL 表示处理不了,
+// 交给普通版本 (由它给出错误信息, 或者换成大整数)
+// 有一个是浮点数, 另一个是数字时按 double 算
+int lval_dbl_pair(lval *a, lval *b, double *x, double *y)
+{
+  if (!(LVAL_IS_NUMBER(a) && LVAL_IS_NUMBER(b)) || (LVAL_TYPE(a) != LVAL_DBL && LVAL_TYPE(b) != LVAL_DBL))
+    return 0;
+  *x = lval_to_double(a);
+  *y = lval_to_double(b);
+  return 1;
+}
+lval *lbin_add(lval *a, lval *b)
+{
+  double x, y;
+  if (LVAL_IS_INT(a) && LVAL_IS_INT(b))
+    return lval_num(LVAL_NUMV(a) + LVAL_NUMV(b));
+  return lval_dbl_pair(a, b, &x, &y) ? lval_dbl(x + y) : NULL;
+}
+lval *lbin_sub(lval *a, lval *b)
+{
+  double x, y;
+  if (LVAL_IS_INT(a) && LVAL_IS_INT(b))
+    return lval_num(LVAL_NUMV(a) - LVAL_NUMV(b));
+  return lval_dbl_pair(a, b, &x, &y) ? lval_dbl(x - y) : NULL;
+}
+lval *lbin_mul(lval *a, lval *b)
+{
+  long n;
+  double x, y;
+  if (LVAL_IS_INT(a) && LVAL_IS_INT(b))
+    return __builtin_mul_overflow(LVAL_NUMV(a), LVAL_NUMV(b), &n) ? NULL : lval_num(n);
+  return lval_dbl_pair(a, b, &x, &y) ? lval_dbl(x * y) : NULL;
+}
+lval *lbin_div(lval *a, lval *b)
+{
+  double x, y;
+  if (LVAL_IS_INT(a) && LVAL_IS_INT(b))
+    return LVAL_NUMV(b) == 0 ? NULL : lval_num(LVAL_NUMV(a) / LVAL_NUMV(b));
+  return lval_dbl_pair(a, b, &x, &y) ? lval_dbl(x / y) : NULL;
+}
+// 参数里有向量 (矩阵) 时逐元素计算, 数字广播到每个元素; 从左到右两两算, 两边都是数字时用普通版本
+lval *lval_vec_arith(lenv *e, lval *v, int op)
+{
+  static lbuildin scalar[] = {buildin_add, buildin_sub, buildin_mul, buildin_div};
+  int vecs = 0;
+  FORLESS(v->count)
+  {
+    int t = LVAL_TYPE(v->cell[i]);
+    LASSERT(v, t == LVAL_NUM || t == LVAL_DBL || t == LVAL_VEC || t == LVAL_MAT, "buildin op operate on non-number!");
+    vecs += t == LVAL_VEC || t == LVAL_MAT;
+  }
+  LASSERT(v, vecs, "buildin op operate on non-number!");
+  // (- v) 是 0 - v, 其余的一个参数时就是它自己
+  lval *acc = v->count == 1 && op == LVEC_SUB ? LVAL_IMM(0) : lval_pop(v, 0);
+  while (v->count)
+  {
+    lval *x = lval_pop(v, 0);
+    lval *r;
+    if (!LVAL_IS_ARRAY(acc) && !LVAL_IS_ARRAY(x))
+      r = scalar[op](e, lval_add(lval_add(lval_sexpr(), acc), x));
+    else
+    {
+      r = lvec_binop(acc, x, op);
+      lval_del(acc);
+      lval_del(x);
+    }
+    acc = r;
+    if (LVAL_TYPE(acc) == LVAL_ERR)
+      break;
+  }
+  lval_del(v);
+  return acc;
+}
+lval *buildin_var(lenv *e, lval *v, char *op)
+{
+  LASSERT_TYPE("def", v, 0, LVAL_QEXPR);
+  lval *syms = v->cell[0];
+  LASSERT(v, syms->count == v->count - 1, "Function '%s' passed invalid argument!"
+                                          "params count %i, argument count %i",
+          "def", syms->count, (v->count - 1));
+  // 先全部检查, 不是符号的话一个也不定义
+  FORLESS(syms->count)
+  {
+    LASSERT(v, LVAL_TYPE(syms->cell[i]) == LVAL_SYM, "Function '%s' passed invalid format type."
+                                                     "Got %s, Expect %s",
+            "def", ltype_name(LVAL_TYPE(syms->cell[i])), ltype_name(LVAL_SYM));
+  }
+  FORLESS(syms->count)
+  {
+    if (strcmp(op, "def") == 0)
+    {
+      lenv_def(e, syms->cell[i], v->cell[i + 1]);
+    }
+    else
+    {
+      lenv_put(e, syms->cell[i], v->cell[i + 1]);
+    }
+  }
+  lval_del(v);
+  return lval_sexpr();
+}
+lval *buildin_def(lenv *e, lval *v)
+{
+  return buildin_var(e, v, "def");
+}
+lval *buildin_put(lenv *e, lval *v)
+{
+  return buildin_var(e, v, "put");
+}
+
+lval *buildin_lambda(lenv *e, lval *v)
+{
+  LASSERT_NUM("\\", v, 2);
+  LASSERT_TYPE("\\", v, 0, LVAL_QEXPR);
+  LASSERT_TYPE("\\", v, 1, LVAL_QEXPR);
+  lval *formals = lval_pop(v, 0);
+  lval *body = lval_pop(v, 0);
+  lval_del(v);
+  // 先编译好 body, 对形参的引用变成环境里的槽位
+  if (lvm_enabled)
+    lval_code(body, formals);
+  return lval_lambda(formals, body, NULL);
+}
+// 大小比较只有比较符号不同, 用宏展开出普通版本和两个参数的快速版本
+// 有浮点数时按 double 比较 (nan 和谁比都是假)
+#define LASSERT_NUMBER(func, arg, i) LASSERT(arg, LVAL_IS_NUMBER(arg->cell[i]), "Function '%s' passed invalid format type." \
+                                                                                "Got %s, Expect %s",                        \
+                                             func, ltype_name(LVAL_TYPE(arg->cell[i])), ltype_name(LVAL_NUM))
+#define LBUILDIN_ORD(name, op, cmp, vop)                           \
+  lval *lbin_##name(lval *a, lval *b)                              \
+  {                                                                \
+    double x, y;                                                   \
+    if (LVAL_IS_INT(a) && LVAL_IS_INT(b))                          \
+      return LVAL_IMM(LVAL_NUMV(a) cmp LVAL_NUMV(b));              \
+    if (lval_dbl_pair(a, b, &x, &y))                               \
+      return LVAL_IMM(x cmp y);                                    \
+    if (LVAL_TYPE(a) != LVAL_NUM || LVAL_TYPE(b) != LVAL_NUM)      \
+      return NULL;                                                 \
+    return LVAL_IMM(lval_num_cmp(a, b) cmp 0);                     \
+  }                                                                \
+  lval *buildin_##name(lenv *e, lval *v)                           \
+  {                                                                \
+    LASSERT_NUM(op, v, 2);                                         \
+    lval *r;                                                       \
+    if (LVAL_IS_ARRAY(v->cell[0]) || LVAL_IS_ARRAY(v->cell[1]))    \
+    {                                                              \
+      r = lvec_binop(v->cell[0], v->cell[1], vop);                 \
+      lval_del(v);                                                 \
+      return r;                                                    \
+    }                                                              \
+    LASSERT_NUMBER(op, v, 0);                                      \
+    LASSERT_NUMBER(op, v, 1);                                      \
+    r = lbin_##name(v->cell[0], v->cell[1]);                       \
+    lval_del(v);                                                   \
+    return r;                                                      \
+  }
+LBUILDIN_ORD(gt, ">", >, LVEC_GT)
+LBUILDIN_ORD(ge, ">=", >=, LVEC_GE)
+LBUILDIN_ORD(lt, "<", <, LVEC_LT)
+LBUILDIN_ORD(le, "<=", <=, LVEC_LE)
+int lval_compare(lval *x, lval *y)
+{
+  if (LVAL_IS_INT(x) && LVAL_IS_INT(y))
+    return x == y;
+  if (LVAL_IS_NUMBER(x) && LVAL_IS_NUMBER(y))
+    return lval_num_eq(x, y);
+  if (LVAL_TYPE(x) != LVAL_TYPE(y))
+    return 0;
+  switch (LVAL_TYPE(x))
+  {
+  case LVAL_SYM:
+    return x->sym == y->sym;
+  case LVAL_ERR:
+    return strcmp(x->err, y->err) == 0;
+  case LVAL_STR:
+    return x->len == y->len && memcmp(x->str, y->str, x->len) == 0;
+  case LVAL_FUN:
+    // 内建函数没有 formals / body, 只要有一边是内建函数就只比函数指针
+    if (x->buildin || y->buildin)
+      return x->buildin == y->buildin;
+    return lval_compare(x->formals, y->formals) && lval_compare(x->body, y->body);
+  case LVAL_MEMO:
+    return x->memo == y->memo;
+  case LVAL_VEC:
+  case LVAL_MAT:
+    return lvec_equal(x->vec, y->vec);
+  case LVAL_SEXPR:
+  case LVAL_QEXPR:
+    if (x->count != y->count)
+      return 0;
+    FORLESS(x->count)
+    {
+      if (lval_compare(x->cell[i], y->cell[i]) == 0)
+        return 0;
+    }
+    return 1;
+  }
+  return 1;
+}
+lval *buildin_eq(lenv *e, lval *v)
+{
+  LASSERT_NUM("==", v, 2);
+  int x = lval_compare(v->cell[0], v->cell[1]);
+  lval_del(v);
+  return lval_num(x);
+}
+lval *buildin_ne(lenv *e, lval *v)
+{
+  LASSERT_NUM("!=", v, 2);
+  int x = !lval_compare(v->cell[0], v->cell[1]);
+  lval_del(v);
+  return lval_num(x);
+}
+lval *lbin_eq(lval *a, lval *b)
+{
+  return LVAL_IMM(lval_compare(a, b));
+}
+lval *lbin_ne(lval *a, lval *b)
+{
+  return LVAL_IMM(!lval_compare(a, b));
+}
+lval *buildin_if(lenv *e, lval *v)
+{
+  LASSERT_NUM("if", v, 3);
+  LASSERT_TYPE("if", v, 0, LVAL_NUM);
+  LASSERT_TYPE("if", v, 1, LVAL_QEXPR);
+  LASSERT_TYPE("if", v, 2, LVAL_QEXPR);
+  lval *x;
+  if (LVAL_NUMV(v->cell[0]) >= 1)
+  {
+    // lval_eval 是直接执行语句
+    // buildin_eval 支持完整program, 所以其子对象必须是Q-Expression
+    // 所以这里直接把 元素从v 中pop出来成为独立对象(其在执行时被释放)
+    x = lval_own(lval_pop(v, 1));
+  }
+  else
+  {
+    x = lval_own(lval_pop(v, 2));
+  }
+  lval_del(v);
+  x->type = LVAL_SEXPR;
+  return lval_eval(e, x);
+}
+// load "lispy.lsp"
+lval *buildin_load(lenv *e, lval *v)
+{
+  LASSERT_NUM("load", v, 1);
+  LASSERT_TYPE("load", v, 0, LVAL_STR);
+  lval *expr = lval_read_file(v->cell[0]->str);
+  lval_del(v);
+  if (LVAL_TYPE(expr) == LVAL_ERR)
+    return expr;
+  // 逐个运行
+  while (expr->count)
+  {
+    lval *x = lval_eval_top(e, lval_pop(expr, 0));
+    if (LVAL_TYPE(x) == LVAL_ERR)
+    {
+      lval_println(x);
+    }
+    lval_del(x);
+  }
+  lval_del(expr);
+
+  return lval_sexpr();
+}
+lval *lgc_stat(char *name, lval *x)
+{
+  return lval_add(lval_add(lval_qexpr(), lval_str(name)), x);
+}
+// (gc-stats ()) 返回 { {"mode" "gen"} {"minor" 3} ... }, 参数忽略
+lval *buildin_gc_stats(lenv *e, lval *v)
+{
+  char *modes[] = {"rc", "marksweep", "gen"};
+  lval_del(v);
+  lval *x = lval_qexpr();
+  x = lval_add(x, lgc_stat("mode", lval_str(modes[lgc_mode])));
+  x = lval_add(x, lgc_stat("minor", lval_num(lgc_minor_count)));
+  x = lval_add(x, lgc_stat("major", lval_num(lgc_major_count)));
+  x = lval_add(x, lgc_stat("live", lval_num(lgc_heap_live())));
+  x = lval_add(x, lgc_stat("allocated", lval_num(lgc_allocated)));
+  x = lval_add(x, lgc_stat("freed", lval_num(lgc_freed)));
+  x = lval_add(x, lgc_stat("heap-kb", lval_num((long)(lval_pool.nchunks + lenv_pool.nchunks) * LPOOL_CHUNK_SIZE / 1024)));
+  x = lval_add(x, lgc_stat("pause-us", lval_num((long)(lgc_pause * 1e6))));
+  return x;
+}
+lval *buildin_print(lenv *e, lval *v)
+{
+  FORLESS(v->count)
+  {
+    lval_print(v->cell[i]);
+    putchar(' ');
+  }
+  putchar('\n');
+  lval_del(v);
+  return lval_sexpr();
+}
+// 和 lval_compare 一致的结构哈希: lval_compare 认为相等的值哈希一定相同
+unsigned long lval_hash_bytes(unsigned long h, const char *p, int n)
+{
+  FORLESS(n)
+  {
+    h = (h ^ (unsigned char)p[i]) * 1099511628211ul;
+  }
+  return h;
+}
+unsigned long lval_hash(lval *v)
+{
+  unsigned long h = 14695981039346656037ul ^ LVAL_TYPE(v);
+  switch (LVAL_TYPE(v))
+  {
+  case LVAL_NUM:
+  {
+    // 大整数的表示是唯一的, 直接哈希符号和各段
+    if (LVAL_IS_BIG(v))
+      return lval_hash_bytes(lval_hash_bytes(h, (char *)&v->big->neg, sizeof(int)),
+                             (char *)v->big->d, sizeof(uint32_t) * v->big->n);
+    long n = LVAL_NUMV(v);
+    return lval_hash_bytes(h, (char *)&n, sizeof(n));
+  }
+  case LVAL_DBL:
+  {
+    // 和相等的整数哈希一样, 见 lval_num_eq
+    double d = LVAL_DBLV(v);
+    lval *n = lval_dbl_int(d);
+    if (n)
+    {
+      h = lval_hash(n);
+      lval_del(n);
+      return h;
+    }
+    return lval_hash_bytes(h, (char *)&d, sizeof(d));
+  }
+  case LVAL_SYM:
+    return lval_hash_bytes(h, (char *)&v->sym, sizeof(v->sym));
+  case LVAL_ERR:
+    return lval_hash_bytes(h, v->err, strlen(v->err));
+  case LVAL_STR:
+    return lval_hash_bytes(h, v->str, v->len);
+  case LVAL_FUN:
+    // 和 lval_compare 一样, 内建函数只看函数指针, 不碰 formals / body
+    if (v->buildin)
+      return lval_hash_bytes(h, (char *)&v->buildin, sizeof(v->buildin));
+    return (lval_hash(v->formals) * 31) ^ lval_hash(v->body);
+  case LVAL_MEMO:
+    return lval_hash_bytes(h, (char *)&v->memo, sizeof(v->memo));
+  case LVAL_VEC:
+  case LVAL_MAT:
+    // 整数值的元素按 long 哈希, 这样相等的整数向量和浮点数向量哈希一样
+    for (long i = 0; i < v->vec->n; i++)
+    {
+      int dbl = v->vec->kind == LVEC_DBL;
+      double d = dbl ? v->vec->d[i] : 0;
+      int whole = !dbl || (d > -9.2e18 && d < 9.2e18 && d == (double)(long)d);
+      long n = dbl ? (whole ? (long)d : 0) : v->vec->i[i];
+      h = whole ? lval_hash_bytes(h, (char *)&n, sizeof(n)) : lval_hash_bytes(h, (char *)&d, sizeof(d));
+    }
+    return h;
+  case LVAL_SEXPR:
+  case LVAL_QEXPR:
+    FORLESS(v->count)
+    {
+      h = (h ^ lval_hash(v->cell[i])) * 1099511628211ul;
+    }
+    return h;
+  }
+  return h;
+}
+// memo: 按参数缓存函数的结果. 哈希表 + LRU 链表, 超过 max 个时丢掉最久没用过的
+// 参数列表和结果都持有引用; 出错的结果不缓存
+#define LMEMO_MAX 4096
+typedef struct lmemo_entry lmemo_entry;
+struct lmemo_entry
+{
+  unsigned long hash;
+  lval *args;
+  lval *res;
+  lmemo_entry *chain;      // 同一个桶里的下一个
+  lmemo_entry *prev, *next; // LRU, head 是最近用过的
+};
+struct lmemo
+{
+  int rc;
+  lval *fn;
+  int count;
+  int max;
+  int nbuckets;
+  lmemo_entry **buckets;
+  lmemo_entry *head, *tail;
+  long hits, misses;
+};
+lval *lval_memo(lval *fn, int max)
+{
+  lmemo *m = calloc(1, sizeof(lmemo));
+  m->rc = 1;
+  m->fn = fn;
+  m->max = max;
+  m->nbuckets = 16;
+  m->buckets = calloc(m->nbuckets, sizeof(lmemo_entry *));
+  NEWLVAL;
+  v->type = LVAL_MEMO;
+  v->memo = m;
+  return v;
+}
+lmemo *lmemo_share(lmemo *m)
+{
+  m->rc++;
+  return m;
+}
+void lmemo_release(lmemo *m)
+{
+  if (--m->rc > 0)
+    return;
+  for (lmemo_entry *x = m->head, *next; x; x = next)
+  {
+    next = x->next;
+    lval_del(x->args);
+    lval_del(x->res);
+    free(x);
+  }
+  lval_del(m->fn);
+  free(m->buckets);
+  free(m);
+}
+void lmemo_mark(lmemo *m)
+{
+  lgc_mark(m->fn);
+  for (lmemo_entry *x = m->head; x; x = x->next)
+  {
+    lgc_mark(x->args);
+    lgc_mark(x->res);
+  }
+}
+void lmemo_unlink(lmemo *m, lmemo_entry *x)
+{
+  if (x->prev)
+    x->prev->next = x->next;
+  else
+    m->head = x->next;
+  if (x->next)
+    x->next->prev = x->prev;
+  else
+    m->tail = x->prev;
+}
+void lmemo_push(lmemo *m, lmemo_entry *x)
+{
+  x->prev = NULL;
+  x->next = m->head;
+  if (m->head)
+    m->head->prev = x;
+  else
+    m->tail = x;
+  m->head = x;
+}
+void lmemo_evict(lmemo *m)
+{
+  lmemo_entry *x = m->tail;
+  lmemo_entry **p = &m->buckets[x->hash & (m->nbuckets - 1)];
+  while (*p != x)
+    p = &(*p)->chain;
+  *p = x->chain;
+  lmemo_unlink(m, x);
+  lval_del(x->args);
+  lval_del(x->res);
+  free(x);
+  m->count--;
+}
+void lmemo_insert(lmemo *m, unsigned long hash, lval *args, lval *res)
+{
+  if (m->count >= m->nbuckets)
+  {
+    // 扩容, 按哈希值重新分桶
+    int n = m->nbuckets * 2;
+    lmemo_entry **b = calloc(n, sizeof(lmemo_entry *));
+    for (lmemo_entry *x = m->head; x; x = x->next)
+    {
+      x->chain = b[x->hash & (n - 1)];
+      b[x->hash & (n - 1)] = x;
+    }
+    free(m->buckets);
+    m->buckets = b;
+    m->nbuckets = n;
+  }
+  lmemo_entry *x = malloc(sizeof(lmemo_entry));
+  x->hash = hash;
+  // 缓存比这条语句活得久, 不能指向 arena
+  x->args = larena_on ? lval_promote(args) : lval_ref(args);
+  x->res = larena_on ? lval_promote(res) : lval_ref(res);
+  x->chain = m->buckets[hash & (m->nbuckets - 1)];
+  m->buckets[hash & (m->nbuckets - 1)] = x;
+  lmemo_push(m, x);
+  m->count++;
+  while (m->count > m->max)
+    lmemo_evict(m);
+}
+lval *lval_call(lenv *e, lval *v, lval *f);
+// 调用 (memo f): 参数相同 (lval_compare) 时直接返回上次的结果
+lval *lmemo_call(lenv *e, lval *v, lval *f)
+{
+  lmemo *m = f->memo;
+  unsigned long hash = lval_hash(v);
+  for (lmemo_entry *x = m->buckets[hash & (m->nbuckets - 1)]; x; x = x->chain)
+  {
+    if (x->hash == hash && lval_compare(x->args, v))
+    {
+      m->hits++;
+      lmemo_unlink(m, x);
+      lmemo_push(m, x);
+      lval_del(v);
+      return lval_ref(x->res);
+    }
+  }
+  m->misses++;
+  lval *args = lval_copy(v);
+  m->rc++; // 调用期间 f 可能被重新定义而释放
+  lval *res = lval_call(e, v, m->fn);
+  if (LVAL_TYPE(res) != LVAL_ERR && m->max > 0)
+  {
+    lmemo_insert(m, hash, args, res);
+    lgc_write(f);
+  }
+  lval_del(args);
+  lmemo_release(m);
+  return res;
+}
+// (memo f) 或 (memo f n): 最多缓存 n 组参数 (默认 LMEMO_MAX)
+lval *buildin_memo(lenv *e, lval *v)
+{
+  LASSERT(v, v->count == 1 || v->count == 2, "Function '%s' passed invalid count of Arguments."
+                                              "Got %i, Expect %i",
+          "memo", v->count, 1);
+  LASSERT(v, LVAL_TYPE(v->cell[0]) == LVAL_FUN || LVAL_TYPE(v->cell[0]) == LVAL_MEMO,
+          "Function '%s' passed invalid format type."
+          "Got %s, Expect %s",
+          "memo", ltype_name(LVAL_TYPE(v->cell[0])), ltype_name(LVAL_FUN));
+  int max = LMEMO_MAX;
+  if (v->count == 2)
+  {
+    LASSERT_TYPE("memo", v, 1, LVAL_NUM);
+    max = LVAL_NUMV(v->cell[1]);
+  }
+  lval *fn = larena_on ? lval_promote(v->cell[0]) : lval_ref(v->cell[0]);
+  lval_del(v);
+  return lval_memo(fn, max);
+}
+// (memo-stats f) 返回 { {"hits" 10} {"misses" 3} {"size" 3} {"max" 4096} }
+lval *buildin_memo_stats(lenv *e, lval *v)
+{
+  LASSERT_NUM("memo-stats", v, 1);
+  LASSERT_TYPE("memo-stats", v, 0, LVAL_MEMO);
+  lmemo *m = v->cell[0]->memo;
+  lval *x = lval_qexpr();
+  x = lval_add(x, lgc_stat("hits", lval_num(m->hits)));
+  x = lval_add(x, lgc_stat("misses", lval_num(m->misses)));
+  x = lval_add(x, lgc_stat("size", lval_num(m->count)));
+  x = lval_add(x, lgc_stat("max", lval_num(m->max)));
+  lval_del(v);
+  return x;
+}
+// (vec 1 2 3) 或 (vec {1 2 3}): 都是整数时是整数向量, 有浮点数时是浮点数向量
+lval *buildin_vec(lenv *e, lval *v)
+{
+  lval *xs = v->count == 1 && LVAL_TYPE(v->cell[0]) == LVAL_QEXPR ? v->cell[0] : v;
+  int kind = LVEC_INT;
+  FORLESS(xs->count)
+  {
+    lval *x = xs->cell[i];
+    LASSERT(v, !LVAL_IS_BIG(x), "Vector element out of range!");
+    LASSERT(v, LVAL_IS_LONG(x) || LVAL_TYPE(x) == LVAL_DBL, "Function '%s' passed invalid format type."
+                                                             "Got %s, Expect %s",
+            "vec", ltype_name(LVAL_TYPE(x)), ltype_name(LVAL_NUM));
+    if (LVAL_TYPE(x) == LVAL_DBL)
+      kind = LVEC_DBL;
+  }
+  lvec *r = lvec_new(kind, xs->count);
+  LASSERT(v, r, "Can not allocate vector of %i elements!", xs->count);
+  FORLESS(xs->count)
+  {
+    lval *x = xs->cell[i];
+    if (kind == LVEC_INT)
+      r->i[i] = LVAL_NUMV(x);
+    else
+      r->d[i] = lval_to_double(x);
+  }
+  lval_del(v);
+  return lval_vec(r);
+}
+// (vec-range 4) 是 (vec 0 1 2 3)
+lval *buildin_vec_range(lenv *e, lval *v)
+{
+  LASSERT_NUM("vec-range", v, 1);
+  LASSERT(v, LVAL_IS_LONG(v->cell[0]) && LVAL_NUMV(v->cell[0]) >= 0, "Function '%s' passed invalid length!", "vec-range");
+  long n = LVAL_NUMV(v->cell[0]);
+  lvec *r = lvec_new(LVEC_INT, n);
+  LASSERT(v, r, "Can not allocate vector of %li elements!", n);
+  for (long i = 0; i < n; i++)
+    r->i[i] = i;
+  lval_del(v);
+  return lval_vec(r);
+}
+lval *buildin_vec_len(lenv *e, lval *v)
+{
+  LASSERT_NUM("vec-len", v, 1);
+  LASSERT_TYPE("vec-len", v, 0, LVAL_VEC);
+  long n = v->cell[0]->vec->n;
+  lval_del(v);
+  return lval_num(n);
+}
+// (vec-nth i v), 和 nth 一样下标在前
+lval *buildin_vec_nth(lenv *e, lval *v)
+{
+  LASSERT_NUM("vec-nth", v, 2);
+  LASSERT_TYPE("vec-nth", v, 0, LVAL_NUM);
+  LASSERT_TYPE("vec-nth", v, 1, LVAL_VEC);
+  lvec *x = v->cell[1]->vec;
+  long i = LVAL_NUMV(v->cell[0]);
+  LASSERT(v, LVAL_IS_LONG(v->cell[0]) && i >= 0 && i < x->n, "Function '%s' passed index %li out of range!", "vec-nth", i);
+  lval *r = lvec_get(x, i);
+  lval_del(v);
+  return r;
+}
+lval *buildin_vec_list(lenv *e, lval *v)
+{
+  LASSERT_NUM("vec-list", v, 1);
+  LASSERT_TYPE("vec-list", v, 0, LVAL_VEC);
+  lvec *x = v->cell[0]->vec;
+  lval *r = lval_qexpr();
+  for (long i = 0; i < x->n; i++)
+    r = lval_add(r, lvec_get(x, i));
+  lval_del(v);
+  return r;
+}
+// 整数的和 / 点积溢出时用大整数重算, y 为 NULL 时是求和
+lval *lvec_big_reduce(lvec *x, lvec *y)
+{
+  lbig *acc = lbig_new(0);
+  for (long i = 0; i < x->n; i++)
+  {
+    lbig *t = lbig_from_long(x->i[i]);
+    if (y)
+    {
+      lbig *u = lbig_from_long(y->i[i]);
+      lbig *p = lbig_mul(t, u);
+      lbig_release(t);
+      lbig_release(u);
+      t = p;
+    }
+    lbig *r = lbig_add(acc, t, 0);
+    lbig_release(acc);
+    lbig_release(t);
+    acc = r;
+  }
+  return lval_big(acc);
+}
+lval *buildin_vec_reduce(lenv *e, lval *v, char *func, int red)
+{
+  int n = red == LVEC_DOT ? 2 : 1;
+  LASSERT_NUM(func, v, n);
+  FORLESS(n)
+  {
+    LASSERT_TYPE(func, v, i, LVAL_VEC);
+  }
+  lvec *x = v->cell[0]->vec;
+  lvec *y = v->cell[n - 1]->vec;
+  LASSERT(v, x->n == y->n, "Vector length mismatch! Got %li and %li", x->n, y->n);
+  LASSERT(v, x->n || red == LVEC_SUM || red == LVEC_DOT, "Function '%s' passed empty vector!", func);
+  x->rc++;
+  y->rc++;
+  if (x->kind != y->kind)
+  {
+    x = lvec_to_dbl(x);
+    y = lvec_to_dbl(y);
+  }
+  lval *r;
+  union
+  {
+    long i;
+    double d;
+  } out;
+  if (lvec_reducers[lvec_simd][x->kind][red](x->d, y->d, x->n, &out))
+    r = lvec_big_reduce(x, red == LVEC_DOT ? y : NULL);
+  else
+    r = x->kind == LVEC_DBL ? lval_dbl(out.d) : lval_num(out.i);
+  lvec_release(x);
+  lvec_release(y);
+  lval_del(v);
+  return r;
+}
+lval *buildin_vec_sum(lenv *e, lval *v)
+{
+  return buildin_vec_reduce(e, v, "vec-sum", LVEC_SUM);
+}
+lval *buildin_vec_min(lenv *e, lval *v)
+{
+  return buildin_vec_reduce(e, v, "vec-min", LVEC_MIN);
+}
+lval *buildin_vec_max(lenv *e, lval *v)
+{
+  return buildin_vec_reduce(e, v, "vec-max", LVEC_MAX);
+}
+lval *buildin_vec_dot(lenv *e, lval *v)
+{
+  return buildin_vec_reduce(e, v, "vec-dot", LVEC_DOT);
+}
+// r x c 个元素的存储, 清零. 尺寸相乘溢出或者分配失败时返回 NULL, 矩阵都从这里分配
+lvec *lmat_new(int kind, long r, long c)
+{
+  long n;
+  if (r < 0 || c < 0 || __builtin_mul_overflow(r, c, &n))
+    return NULL;
+  lvec *m = lvec_new(kind, n);
+  if (m)
+    memset(m->d, 0, sizeof(double) * n);
+  return m;
+}
+#define LMAT_ALLOC_ERR "Function '%s' can not allocate %lix%li matrix!"
+// 矩阵的元素都是 double (比较的结果除外)
+// (mat {{1 2} {3 4}}) 每行一个 Q-Expression; (mat 2 3 v) 把长度 6 的向量按行排成 2 x 3
+lval *buildin_mat(lenv *e, lval *v)
+{
+  if (v->count == 3)
+  {
+    LASSERT_TYPE("mat", v, 0, LVAL_NUM);
+    LASSERT_TYPE("mat", v, 1, LVAL_NUM);
+    LASSERT_TYPE("mat", v, 2, LVAL_VEC);
+    long r = LVAL_NUMV(v->cell[0]), c = LVAL_NUMV(v->cell[1]), n;
+    lvec *x = v->cell[2]->vec;
+    LASSERT(v, r >= 0 && c >= 0 && !__builtin_mul_overflow(r, c, &n) && n == x->n, "Function '%s' can not shape %li elements as %lix%li!", "mat", x->n, r, c);
+    lvec *m = lmat_new(LVEC_DBL, r, c);
+    LASSERT(v, m, LMAT_ALLOC_ERR, "mat", r, c);
+    x->rc++;
+    x = lvec_to_dbl(x);
+    memcpy(m->d, x->d, sizeof(double) * x->n);
+    lvec_release(x);
+    lval_del(v);
+    return lval_mat(m, r, c);
+  }
+  LASSERT_NUM("mat", v, 1);
+  LASSERT_TYPE("mat", v, 0, LVAL_QEXPR);
+  lval *rows = v->cell[0];
+  long r = rows->count, c = r ? -1 : 0;
+  FORLESS(r)
+  {
+    lval *row = rows->cell[i];
+    LASSERT(v, LVAL_TYPE(row) == LVAL_QEXPR, "Function '%s' passed invalid format type."
+                                             "Got %s, Expect %s",
+            "mat", ltype_name(LVAL_TYPE(row)), ltype_name(LVAL_QEXPR));
+    if (c < 0)
+      c = row->count;
+    LASSERT(v, row->count == c, "Function '%s' passed rows of different length!", "mat");
+    for (int j = 0; j < c; j++)
+    {
+      lval *x = row->cell[j];
+      LASSERT(v, LVAL_IS_NUMBER(x), "Function '%s' passed invalid format type."
+                                    "Got %s, Expect %s",
+              "mat", ltype_name(LVAL_TYPE(x)), ltype_name(LVAL_NUM));
+    }
+  }
+  lvec *m = lmat_new(LVEC_DBL, r, c);
+  LASSERT(v, m, LMAT_ALLOC_ERR, "mat", r, c);
+  FORLESS(r)
+  {
+    for (int j = 0; j < c; j++)
+      m->d[i * c + j] = lval_to_double(rows->cell[i]->cell[j]);
+  }
+  lval_del(v);
+  return lval_mat(m, r, c);
+}
+// (mat-list m) 是 {{1.0 2.0} {3.0 4.0}}
+lval *buildin_mat_list(lenv *e, lval *v)
+{
+  LASSERT_NUM("mat-list", v, 1);
+  LASSERT_TYPE("mat-list", v, 0, LVAL_MAT);
+  lvec *x = v->cell[0]->vec;
+  lval *r = lval_qexpr();
+  for (long i = 0; i < x->rows; i++)
+  {
+    lval *row = lval_qexpr();
+    for (long j = 0; j < x->cols; j++)
+      row = lval_add(row, lvec_get(x, i * x->cols + j));
+    r = lval_add(r, row);
+  }
+  lval_del(v);
+  return r;
+}
+// (mat-shape m) 是 {行数 列数}
+lval *buildin_mat_shape(lenv *e, lval *v)
+{
+  LASSERT_NUM("mat-shape", v, 1);
+  LASSERT_TYPE("mat-shape", v, 0, LVAL_MAT);
+  lvec *x = v->cell[0]->vec;
+  lval *r = lval_add(lval_add(lval_qexpr(), lval_num(x->rows)), lval_num(x->cols));
+  lval_del(v);
+  return r;
+}
+// (mat-ref i j m)
+lval *buildin_mat_ref(lenv *e, lval *v)
+{
+  LASSERT_NUM("mat-ref", v, 3);
+  LASSERT_TYPE("mat-ref", v, 0, LVAL_NUM);
+  LASSERT_TYPE("mat-ref", v, 1, LVAL_NUM);
+  LASSERT_TYPE("mat-ref", v, 2, LVAL_MAT);
+  lvec *x = v->cell[2]->vec;
+  long i = LVAL_NUMV(v->cell[0]), j = LVAL_NUMV(v->cell[1]);
+  LASSERT(v, i >= 0 && i < x->rows && j >= 0 && j < x->cols, "Function '%s' passed index %li %li out of range!", "mat-ref", i, j);
+  lval *r = lvec_get(x, i * x->cols + j);
+  lval_del(v);
+  return r;
+}
+// (mat-eye n) 是 n x n 的单位矩阵
+lval *buildin_mat_eye(lenv *e, lval *v)
+{
+  LASSERT_NUM("mat-eye", v, 1);
+  LASSERT(v, LVAL_IS_LONG(v->cell[0]) && LVAL_NUMV(v->cell[0]) >= 0, "Function '%s' passed invalid length!", "mat-eye");
+  long n = LVAL_NUMV(v->cell[0]);
+  lvec *m = lmat_new(LVEC_DBL, n, n);
+  LASSERT(v, m, LMAT_ALLOC_ERR, "mat-eye", n, n);
+  for (long i = 0; i < n; i++)
+    m->d[i * n + i] = 1;
+  lval_del(v);
+  return lval_mat(m, n, n);
+}
+lval *buildin_mat_t(lenv *e, lval *v)
+{
+  LASSERT_NUM("mat-t", v, 1);
+  LASSERT_TYPE("mat-t", v, 0, LVAL_MAT);
+  lvec *x = v->cell[0]->vec;
+  lvec *t = lmat_new(x->kind, x->cols, x->rows);
+  LASSERT(v, t, LMAT_ALLOC_ERR, "mat-t", x->cols, x->rows);
+  // long 和 double 一样大, 按 double 搬就行
+  lmat_transpose(x->d, t->d, x->rows, x->cols);
+  long r = x->rows, c = x->cols;
+  lval_del(v);
+  return lval_mat(t, c, r);
+}
+// (mat-mul a b): 向量在左边当作一行, 在右边当作一列, 这时结果也是向量
+lval *buildin_mat_mul(lenv *e, lval *v)
+{
+  LASSERT_NUM("mat-mul", v, 2);
+  FORLESS(2)
+  {
+    LASSERT(v, LVAL_IS_ARRAY(v->cell[i]), "Function '%s' passed invalid format type."
+                                          "Got %s, Expect %s",
+            "mat-mul", ltype_name(LVAL_TYPE(v->cell[i])), ltype_name(LVAL_MAT));
+  }
+  int ma = LVAL_TYPE(v->cell[0]) == LVAL_MAT, mb = LVAL_TYPE(v->cell[1]) == LVAL_MAT;
+  lvec *x = v->cell[0]->vec, *y = v->cell[1]->vec;
+  long r = ma ? x->rows : 1, k = ma ? x->cols : x->n;
+  long k2 = mb ? y->rows : y->n, n = mb ? y->cols : 1;
+  LASSERT(v, k == k2, "Matrix shape mismatch! Got %lix%li and %lix%li", r, k, k2, n);
+  lvec *c = lmat_new(LVEC_DBL, r, n);
+  LASSERT(v, c, LMAT_ALLOC_ERR, "mat-mul", r, n);
+  x->rc++;
+  y->rc++;
+  x = lvec_to_dbl(x);
+  y = lvec_to_dbl(y);
+  lmat_muls[lvec_simd](x->d, y->d, c->d, r, k, n);
+  lvec_release(x);
+  lvec_release(y);
+  lval_del(v);
+  return ma && mb ? lval_mat(c, r, n) : lval_vec(c);
+}
+lval *lval_call(lenv *e, lval *v, lval *f)
+{
+  if (f->type == LVAL_MEMO)
+    return lmemo_call(e, v, f);
+  if (f->buildin)
+    return f->buildin(e, v);
+
+  // f 可能被多处共享, 不能修改: 形参从一份拷贝里取, 参数绑定到新的调用环境里
+  // f 已经绑定的参数 (部分应用) 在 f->env 里, 先复制过来
+  lval *formals = lval_copy(f->formals);
+  lenv *env = f->env ? lenv_copy(f->env) : lenv_new();
+  int count = v->count;
+  int total = formals->count;
+  while (v->count)
+  {
+    if (formals->count == 0)
+    {
+      lval_del(v);
+      lval_del(formals);
+      lenv_del(env);
+      return lval_err("Function '%s' passedd too many argument!"
+                      "Got %i, Expect %i",
+                      "call", count, total);
+    }
+    // 此处将fun中的形参拿出，同时将参数对应上
+    // 然后保存到env 环境变量中
+    lval *sym = lval_pop(formals, 0);
+    // def { addCurry } (\ { x y & last } { eval (join (list + x y) (head last) ) })
+    // addCurry 10 20 40 30 -> 10 + 20 + 40 = 70
+    if (sym->sym == lsym_amp)
+    {
+      if (formals->count != 1)
+      {
+        // 先生成报错, 里面要用到 formals->count
+        lval *err = lval_err("Function '%s' pass invalid format argument!"
+                             "Symbol '&' must followed by only one symbol!"
+                             "Got %i, Expect %i",
+                             "call", formals->count, 1);
+        lval_del(sym);
+        lval_del(v);
+        lval_del(formals);
+        lenv_del(env);
+        return err;
+      }
+      lval *syms = lval_pop(formals, 0);
+      lval *vals = buildin_list(env, v);
+      lenv_put(env, syms, vals);
+      lval_del(sym);
+      lval_del(syms);
+      break;
+    }
+    lval *val = lval_pop(v, 0);
+    lenv_put(env, sym, val);
+    lval_del(sym);
+    lval_del(val);
+  }
+  lval_del(v);
+  // 这里的作用，是在上面执行后，仍然还有 `& x`
+  // 其实参数已经写完，只剩复数参数，那么直接给其复制空参数即可执行了
+  if (formals->count != 0 && formals->cell[0]->sym == lsym_amp)
+  {
+    if (formals->count != 2)
+    {
+      lval *err = lval_err("Function '%s' pass invalid format argument!"
+                           "Symbol '&' must followed by only one symbol!"
+                           "Got %i, Expect %i",
+                           "call", formals->count - 1, 1);
+      lval_del(formals);
+      lenv_del(env);
+      return err;
+    }
+    lval_del(lval_pop(formals, 0));
+    lval *syms = lval_pop(formals, 0);
+    lval *vals = lval_qexpr(); // 空参数
+    lenv_put(env, syms, vals);
+    lval_del(syms);
+    lval_del(vals);
+  }
+  // 说明参数全，开始运行
+  if (formals->count == 0)
+  {
+    // 为当前fun的局部环境变量增加父级环境变量
+    env->pair = e;
+    lgc_write(env);
+    lval_del(formals);
+    // 执行时，将环境变量传入，相当于提前有了相关的环境变量
+    // 执行语句是body，拷贝一份给 buildin_eval 去执行
+    lval *res = buildin_eval(env, lval_add(lval_qexpr(), lval_ref(f->body)));
+    lenv_del(env);
+    return res;
+  }
+  else
+  {
+    // 部分应用: 已经绑定的参数成为新函数捕获的环境, 以后不再修改
+    env->pair = NULL;
+    return lval_lambda(formals, lval_ref(f->body), env);
+  }
+}
+
+lval *lval_expr_eval(lenv *e, lval *v)
+{
+  if (lval_deep())
+  {
+    lval_del(v);
+    return lval_err("Stack overflow!");
+  }
+  v = lval_own(v);
+  lval_unshare(v);
+  FORLESS(v->count)
+  {
+    v->cell[i] = lval_eval(e, v->cell[i]);
+    lgc_write(v);
+  }
+  FORLESS(v->count)
+  {
+    if (LVAL_TYPE(v->cell[i]) == LVAL_ERR)
+    {
+      return lval_take(v, i);
+    }
+  }
+  if (v->count == 0)
+    return v;
+  if (v->count == 1)
+    return lval_take(v, 0);
+
+  lval *f = lval_pop(v, 0);
+  if (LVAL_TYPE(f) != LVAL_FUN && LVAL_TYPE(f) != LVAL_MEMO)
+  {
+    lval_del(f);
+    lval_del(v);
+    return lval_err("S-Expression not start with Function!");
+  }
+  lval *res = lval_call(e, v, f);
+  //    lval* res = f->fun(e, v);
+  //    lval* res = buildin(v, f->sym);
+  //    lval* res = buildin_op(v, f->sym);
+  lval_del(f);
+  return res;
+}
+// 字节码虚拟机 (默认, --eval=tree 时退回上面逐个节点求值的方式)
+// 顶层语句和 lambda 的 body 编译一次, 字节码挂在表达式上, 之后直接运行;
+// 运行时临时拼出来的表达式 (eval, unpack ...) 没有字节码, 仍然走 lval_expr_eval
+// (a b (c d)) 编译成: LOOKUP a, LOOKUP b, LOOKUP c, LOOKUP d, CALL 2, CALL 3, RET
+enum
+{
+  LOP_CONST,  // 压入常量
+  LOP_LOOKUP, // 压入变量的值, 带一个内联缓存的编号
+  LOP_LOCAL,  // 压入当前环境第 slot 个变量的值, 对不上时退回 LOOKUP
+  LOP_CALL,   // 栈顶 n 个值按 S-Expression 的规则求值, 结果压回去
+  LOP_TAIL,   // 尾位置上的 CALL, 见 lcode_run
+  LOP_RET,
+  LOP_FOLD // 折叠好的常量, 后面跟着原来的代码, 见 lval_fold
 };
-lenv *lenv_new()
+typedef struct lcodegen
 {
-  lenv *e = malloc(sizeof(lenv));
-  e->count = 0;
-  e->pair = NULL;
-  e->syms = NULL;
-  e->vals = NULL;
-  return e;
-}
-void lenv_del(lenv *e)
+  lcode *c;
+  lval *formals;
+  int opcap;
+  int constcap;
+  int sp;
+} lcodegen;
+void lcodegen_word(lcodegen *g, int w)
 {
-  FORLESS(e->count)
+  lcode *c = g->c;
+  if (c->nops == g->opcap)
   {
-    free(e->syms[i]);
-    lval_del(e->vals[i]);
+    g->opcap = g->opcap ? g->opcap * 2 : 16;
+    c->ops = realloc(c->ops, sizeof(int) * g->opcap);
   }
-  free(e->syms);
-  free(e->vals);
-  free(e);
+  c->ops[c->nops++] = w;
 }
-lenv *lenv_copy(lenv *e)
+void lcodegen_emit(lcodegen *g, int op, int arg)
 {
-  lenv *n = malloc(sizeof(lenv));
-  n->count = e->count;
-  n->pair = e->pair;
-  n->syms = malloc(sizeof(char *) * n->count);
-  n->vals = malloc(sizeof(lval *) * n->count);
-  FORLESS(n->count)
-  {
-    StringNewCpy(n->syms[i], e->syms[i]);
-    n->vals[i] = lval_copy(e->vals[i]);
-  }
-  return n;
+  lcode *c = g->c;
+  lcodegen_word(g, op);
+  lcodegen_word(g, arg);
+  if (op == LOP_CONST || op == LOP_LOOKUP || op == LOP_LOCAL)
+    g->sp++;
+  if (op == LOP_CALL || op == LOP_TAIL)
+    g->sp -= arg - 1;
+  if (g->sp > c->depth)
+    c->depth = g->sp;
 }
-lval *lenv_get(lenv *e, lval *k)
+int lcodegen_const(lcodegen *g, lval *x)
 {
-  FORLESS(e->count)
-  {
-    if (strcmp(e->syms[i], k->sym) == 0)
-    {
-      return lval_copy(e->vals[i]);
-    }
-  }
-  if (e->pair)
+  lcode *c = g->c;
+  if (c->nconsts == g->constcap)
   {
-    return lenv_get(e->pair, k);
+    g->constcap = g->constcap ? g->constcap * 2 : 8;
+    c->consts = realloc(c->consts, sizeof(lval *) * g->constcap);
   }
-  return lval_err("Unbound Function: %s", k->sym);
+  c->consts[c->nconsts] = x;
+  return c->nconsts++;
 }
-void lenv_put(lenv *e, lval *k, lval *v)
+// 形参在调用环境里的槽位: lval_call 和 lvm_apply 都按形参顺序绑定, '&' 不占位置
+int lval_slot(lval *formals, int sym)
 {
-  FORLESS(e->count)
+  int slot = 0;
+  FORLESS(formals->count)
   {
-    if (strcmp(e->syms[i], k->sym) == 0)
-    {
-      lval_del(e->vals[i]); // 删除之前节点
-      e->vals[i] = lval_copy(v);
-      return;
-    }
+    if (LVAL_TYPE(formals->cell[i]) != LVAL_SYM || formals->cell[i]->sym == lsym_amp)
+      continue;
+    if (formals->cell[i]->sym == sym)
+      return slot;
+    slot++;
   }
-  e->count++;
-  e->syms = realloc(e->syms, sizeof(char *) * e->count);
-  e->vals = reallocf(e->vals, sizeof(lval *) * e->count);
-  e->vals[e->count - 1] = lval_copy(v);
-  StringNewCpy(e->syms[e->count - 1], k->sym);
+  return -1;
 }
-void lenv_def(lenv *e, lval *k, lval *v)
+// 里面有符号或者 S-Expression 的 Q-Expression 多半会被 if / eval 当成代码运行, 顺便编译
+int lval_codelike(lval *v)
 {
-  while (e->pair)
+  FORLESS(v->count)
   {
-    e = e->pair;
+    int t = LVAL_TYPE(v->cell[i]);
+    if (t == LVAL_SYM || t == LVAL_SEXPR)
+      return 1;
   }
-  lenv_put(e, k, v);
+  return 0;
 }
-
-lval *lval_read(mpc_ast_t *t);
-lval *lval_expr_read(mpc_ast_t *t)
+// 常量折叠: (op a b) 里 op 是全局环境里带快速版本的内建函数 (算术 / 比较),
+// a b 是整数常量或者也能折叠, 编译时就算出结果 (只要立即数)
+// 用到的 op 记在 syms 里, 运行时任何一个被重新定义或者被别的环境绑定, 就退回原来的代码
+#define LFOLD_SYMS 8
+lval *lval_fold_value(lval *formals, lval *x, int *syms, int *nsyms)
 {
-  lval *x;
-  if (strcmp(t->tag, ">") == 0)
+  if (LVAL_IS_IMM(x))
+    return x;
+  if (LVAL_TYPE(x) != LVAL_SEXPR || x->count != 3 || LVAL_TYPE(x->cell[0]) != LVAL_SYM)
+    return NULL;
+  int sym = x->cell[0]->sym;
+  if (lenv_root == NULL || lsyms[sym].shadow || *nsyms == LFOLD_SYMS)
+    return NULL;
+  if (formals && lval_slot(formals, sym) >= 0)
+    return NULL;
+  int i = lenv_find(lenv_root, sym);
+  if (i < 0)
+    return NULL;
+  lval *f = lenv_root->vals[i];
+  if (LVAL_TYPE(f) != LVAL_FUN || !f->buildin || !f->binop)
+    return NULL;
+  syms[(*nsyms)++] = sym;
+  lval *a = lval_fold_value(formals, x->cell[1], syms, nsyms);
+  lval *b = a ? lval_fold_value(formals, x->cell[2], syms, nsyms) : NULL;
+  if (b == NULL)
+    return NULL;
+  lval *r = f->binop(a, b);
+  if (r && !LVAL_IS_IMM(r))
   {
-    x = lval_sexpr();
+    lval_del(r);
+    return NULL;
   }
-  if (strstr(t->tag, "sexpr"))
+  return r;
+}
+void lval_compile(lcodegen *g, lval *v);
+int lval_fold(lcodegen *g, lval *x)
+{
+  int syms[LFOLD_SYMS];
+  int n = 0;
+  lval *r = lval_fold_value(g->formals, x, syms, &n);
+  if (r == NULL)
+    return 0;
+  lcodegen_word(g, LOP_FOLD);
+  lcodegen_word(g, lcodegen_const(g, r));
+  int at = g->c->nops;
+  lcodegen_word(g, 0);
+  lcodegen_word(g, n);
+  FORLESS(n)
   {
-    x = lval_sexpr();
+    lcodegen_word(g, syms[i]);
   }
-  if (strstr(t->tag, "qexpr"))
+  int start = g->c->nops;
+  lval_compile(g, x);
+  g->c->ops[at] = g->c->nops - start;
+  return 1;
+}
+void lval_compile(lcodegen *g, lval *v)
+{
+  FORLESS(v->count)
   {
-    x = lval_qexpr();
+    lval *x = v->cell[i];
+    switch (LVAL_TYPE(x))
+    {
+    case LVAL_SYM:
+    {
+      int slot = g->formals ? lval_slot(g->formals, x->sym) : -1;
+      if (slot < 0)
+      {
+        lcodegen_emit(g, LOP_LOOKUP, x->sym);
+        lcodegen_word(g, g->c->ncaches++);
+        break;
+      }
+      lcodegen_emit(g, LOP_LOCAL, x->sym);
+      lcodegen_word(g, slot);
+    }
+    break;
+    case LVAL_SEXPR:
+      if (!lval_fold(g, x))
+        lval_compile(g, x);
+      break;
+    case LVAL_QEXPR:
+      if (lval_codelike(x))
+        lval_code(x, g->formals);
+      // fallthrough
+    default:
+      lcodegen_emit(g, LOP_CONST, lcodegen_const(g, x));
+      break;
+    }
   }
-
-  FORLESS(t->children_num)
+  lcodegen_emit(g, LOP_CALL, v->count);
+}
+// 已有的字节码是不是按 formals 的槽位编译的
+int lcode_match(lcode *c, lval *formals)
+{
+  int n = 0;
+  FORLESS(formals->count)
   {
-    if (strcmp(t->children[i]->contents, "(") == 0)
-      continue;
-    if (strcmp(t->children[i]->contents, ")") == 0)
-      continue;
-    if (strcmp(t->children[i]->contents, "{") == 0)
-      continue;
-    if (strcmp(t->children[i]->contents, "}") == 0)
-      continue;
-    if (strcmp(t->children[i]->tag, "regex") == 0)
-      continue;
-    if (strstr(t->children[i]->tag, "comment"))
+    lval *x = formals->cell[i];
+    if (LVAL_TYPE(x) != LVAL_SYM || x->sym == lsym_amp)
       continue;
-    x = lval_add(x, lval_read(t->children[i]));
+    if (n >= c->nlocals || c->locals[n] != x->sym)
+      return 0;
+    n++;
   }
-  return x;
+  return n == c->nlocals;
 }
-lval *lval_read(mpc_ast_t *t)
+// 取 v 的字节码, 没有就编译一份挂上去
+// 给了 formals (lambda 的 body) 时, 对形参的引用编译成 LOCAL, 槽位和 formals 对不上就重新编译
+lcode *lval_code(lval *v, lval *formals)
 {
-  if (strstr(t->tag, "number"))
+  if (v->code && (formals == NULL || lcode_match(v->code, formals)))
+    return v->code;
+  lcodegen g = {calloc(1, sizeof(lcode)), formals, 0, 0, 0};
+  g.c->rc = 1;
+  g.c->fold_version = lenv_fold_version;
+  if (formals)
   {
-    return lval_check_num(t->contents);
+    g.c->locals = malloc(sizeof(int) * (formals->count + 1));
+    FORLESS(formals->count)
+    {
+      lval *x = formals->cell[i];
+      if (LVAL_TYPE(x) == LVAL_SYM && x->sym != lsym_amp)
+        g.c->locals[g.c->nlocals++] = x->sym;
+    }
   }
-  if (strstr(t->tag, "symbol"))
+  lval_compile(&g, v);
+  g.c->caches = calloc(g.c->ncaches, sizeof(lcache));
+  g.c->ops[g.c->nops - 2] = LOP_TAIL; // 最外层的 CALL 就是整个表达式的值
+  lcodegen_emit(&g, LOP_RET, 0);
+  lval_uncode(v);
+  v->code = g.c;
+  return v->code;
+}
+// 参数正好把形参用完 (包括 '&' 收集剩下的参数) 时, 直接建立调用环境
+// 部分应用, 参数过多, '&' 写法不对等情况返回 NULL, 交给 lval_call 处理 (也由它报错)
+lenv *lvm_bind(lval *f, lval **xs, int n)
+{
+  lval *formals = f->formals;
+  int amp = -1;
+  FORLESS(formals->count)
   {
-    return lval_sym(t->contents);
+    if (LVAL_TYPE(formals->cell[i]) != LVAL_SYM)
+      return NULL;
+    if (amp < 0 && formals->cell[i]->sym == lsym_amp)
+      amp = i;
   }
-  if (strstr(t->tag, "string"))
+  if (amp < 0 ? n != formals->count : formals->count != amp + 2 || n < amp)
+    return NULL;
+  lenv *env = f->env ? lenv_copy(f->env) : lenv_new();
+  int fixed = amp < 0 ? n : amp;
+  FORLESS(fixed)
   {
-    return lval_check_string(t->contents);
+    lenv_bind(env, formals->cell[i]->sym, xs[i]);
+    lval_del(xs[i]);
   }
-
-  return lval_expr_read(t);
-}
-
-lval *buildin_op(lenv *e, lval *v, char *op)
-{
-  FORLESS(v->count)
+  if (amp >= 0)
   {
-    if (v->cell[i]->type != LVAL_NUM)
+    lval *rest = lval_qexpr();
+    for (int i = amp; i < n; i++)
     {
-      lval_del(v);
-      return lval_err("buildin op operate on non-number!");
+      lval_add(rest, xs[i]);
     }
+    lenv_bind(env, formals->cell[amp + 1]->sym, rest);
+    lval_del(rest);
   }
-  lval *x = lval_pop(v, 0);
-  if (v->count == 0 && strcmp(op, "-") == 0)
+  return env;
+}
+// 模板 JIT: lambda body 只用到整数常量, 形参, 两个参数的算术 / 比较内建函数, if
+// 和对自己的调用时 (比如 fib), 调用次数到了 LJIT_THRESHOLD 就按模板直接生成 x86-64 机器码.
+// 形参放在栈上, 表达式的值在 rax, 尾位置上调用自己变成跳转.
+// 这样的 body 没有副作用, 所以机器码里遇到处理不了的情况 (结果超出立即数范围, 除以 0,
+// C 栈快用完, 递归可能超过 --max-depth) 时直接返回 LJIT_FAIL, 整个调用交回解释器从头再算一遍, 结果和报错都不变.
+// 进入前检查参数都是立即数, 用到的全局符号没有被重新定义, 也没有被别的环境绑定
+#define LJIT_THRESHOLD 100
+#define LJIT_ARGS 6 // 形参都用寄存器传 (rdi rsi rdx rcx r8 r9)
+#define LJIT_SYMS 16
+#define LJIT_FAIL INT64_MIN
+#define LJIT_MAX_FAILS 8 // 机器码失败太多次 (比如递归太深) 就不再用
+int ljit_enabled = 1; // --no-jit 时为 0
+char *ljit_stack_limit = NULL;
+long ljit_depth = 0; // 机器码还能再进几层, 每次进入前按 lvm_max_depth 算好
+typedef long (*ljitfn)(long, long, long, long, long, long);
+struct ljit
+{
+  ljitfn fn;
+  size_t size;
+  int nsyms;
+  int syms[LJIT_SYMS];
+  lbuildin fns[LJIT_SYMS]; // 符号应当是哪个内建函数, NULL 表示这个 lambda 自己
+  unsigned long version;   // 上次检查通过时的 lenv_version
+  int fails;
+  int cost; // 解释器里每层调用最多占几帧: lambda 一帧, 每个 if 分支再一帧
+};
+void ljit_free(ljit *j)
+{
+  if (j == NULL)
+    return;
+#ifdef LJIT
+  munmap((void *)j->fn, j->size);
+#endif
+  free(j);
+}
+// 符号 sym 在全局环境里是不是 fn (NULL 时是不是 body 编译成 c 的 lambda)
+int ljit_resolves(int sym, lbuildin fn, lcode *c)
+{
+  int i = lenv_root ? lenv_find(lenv_root, sym) : -1;
+  if (i < 0)
+    return 0;
+  lval *v = lenv_root->vals[i];
+  if (LVAL_TYPE(v) != LVAL_FUN)
+    return 0;
+  if (fn)
+    return v->buildin == fn;
+  return !v->buildin && v->env == NULL && v->body->code == c && lcode_match(c, v->formals) &&
+         v->formals->count == c->nlocals;
+}
+int ljit_guard(ljit *j, lcode *c)
+{
+  FORLESS(j->nsyms)
   {
-    x->num = -x->num;
+    if (lsyms[j->syms[i]].shadow)
+      return 0;
   }
-  while (v->count)
+  if (j->version == lenv_version)
+    return 1;
+  FORLESS(j->nsyms)
   {
-    lval *y = lval_pop(v, 0);
-    if (strcmp(op, "+") == 0)
-    {
-      x->num += y->num;
-    }
-    if (strcmp(op, "-") == 0)
-    {
-      x->num -= y->num;
-    }
-    if (strcmp(op, "*") == 0)
-    {
-      x->num *= y->num;
-    }
-    if (strcmp(op, "/") == 0)
-    {
-      if (y->num == 0)
-      {
-        lval_del(x);
-        x = lval_err("Division By Zero!");
-        break;
-      }
-      x->num /= y->num;
-    }
-    lval_del(y);
+    if (!ljit_resolves(j->syms[i], j->fns[i], c))
+      return 0;
   }
-  lval_del(v);
-  return x;
+  j->version = lenv_version;
+  return 1;
 }
-lval *buildin_head(lenv *e, lval *v)
+#ifdef LJIT
+typedef struct ljitgen
 {
-  LASSERT_NUM("head", v, 1);
-  LASSERT_TYPE("head", v, 0, LVAL_QEXPR);
-  LASSERT_NOT_EMPTY("head", v, 0);
-  lval *x = lval_take(v, 0);
-  while (x->count > 1)
+  unsigned char *buf;
+  int len;
+  int cap;
+  int *fails; // 要跳到失败出口的 rel32 位置
+  int nfails;
+  int body;   // 参数存好之后的位置, 尾调用跳回这里
+  lcode *c;
+  ljit *j;
+  int ok;
+} ljitgen;
+void ljit_bytes(ljitgen *g, const char *b, int n)
+{
+  if (g->len + n > g->cap)
   {
-    lval_del(lval_pop(x, 1));
+    g->cap = (g->len + n) * 2;
+    g->buf = realloc(g->buf, g->cap);
   }
-  return x;
+  memcpy(g->buf + g->len, b, n);
+  g->len += n;
 }
-lval *buildin_tail(lenv *e, lval *v)
+#define LJIT_EMIT(g, ...) ljit_bytes(g, (const char[]){__VA_ARGS__}, sizeof((const char[]){__VA_ARGS__}))
+void ljit_u32(ljitgen *g, int32_t x)
 {
-  LASSERT_NUM("tail", v, 1);
-  LASSERT_TYPE("tail", v, 0, LVAL_QEXPR);
-  LASSERT_NOT_EMPTY("tail", v, 0);
-  lval *x = lval_take(v, 0);
-  lval_del(lval_pop(x, 0));
-  return x;
+  ljit_bytes(g, (char *)&x, 4);
 }
-lval *buildin_list(lenv *e, lval *v)
+void ljit_u64(ljitgen *g, int64_t x)
 {
-  v->type = LVAL_QEXPR;
-  return v;
+  ljit_bytes(g, (char *)&x, 8);
 }
-lval *buildin_eval(lenv *e, lval *v)
+void ljit_patch(ljitgen *g, int at, int to)
 {
-  LASSERT_NUM("eval", v, 1);
-  LASSERT_TYPE("eval", v, 0, LVAL_QEXPR);
-  lval *x = lval_take(v, 0);
-  x->type = LVAL_SEXPR;
-  return lval_eval(e, x);
+  int32_t rel = to - (at + 4);
+  memcpy(g->buf + at, &rel, 4);
 }
-lval *buildin_join(lenv *e, lval *v)
+// jcc/jmp 到失败出口, 位置先记下来最后统一填
+void ljit_fail_jump(ljitgen *g, char cc)
 {
-  FORLESS(v->count)
-  {
-    LASSERT_TYPE("join", v, i, LVAL_QEXPR);
-  }
-  lval *x = lval_pop(v, 0);
-  while (v->count)
-  {
-    lval *y = lval_pop(v, 0);
-    FORLESS(y->count)
-    {
-      //            x = lval_add(x, lval_pop(y, 0));
-      x = lval_add(x, y->cell[i]);
-    }
-    free(y->cell);
-    lval_del(y);
-  }
-  lval_del(v);
-  return x;
+  if (cc)
+    LJIT_EMIT(g, 0x0f, cc);
+  else
+    LJIT_EMIT(g, 0xe9);
+  g->fails = realloc(g->fails, sizeof(int) * (g->nfails + 1));
+  g->fails[g->nfails++] = g->len;
+  ljit_u32(g, 0);
 }
-lval *buildin_add(lenv *e, lval *v)
+#define LJIT_JO 0x80
+#define LJIT_JB 0x82
+#define LJIT_JE 0x84
+#define LJIT_JL 0x8c
+// rax 超出立即数范围就失败: rax * 2 溢出
+void ljit_check_imm(ljitgen *g)
 {
-  return buildin_op(e, v, "+");
+  LJIT_EMIT(g, 0x48, 0x89, 0xc2); // mov rdx, rax
+  LJIT_EMIT(g, 0x48, 0x01, 0xd2); // add rdx, rdx
+  ljit_fail_jump(g, LJIT_JO);
 }
-lval *buildin_sub(lenv *e, lval *v)
+int ljit_use(ljitgen *g, int sym, lbuildin fn)
 {
-  return buildin_op(e, v, "-");
+  ljit *j = g->j;
+  FORLESS(j->nsyms)
+  {
+    if (j->syms[i] == sym)
+      return j->fns[i] == fn;
+  }
+  if (j->nsyms == LJIT_SYMS)
+    return 0;
+  j->syms[j->nsyms] = sym;
+  j->fns[j->nsyms++] = fn;
+  return 1;
 }
-lval *buildin_mul(lenv *e, lval *v)
+int ljit_local(ljitgen *g, int sym)
 {
-  return buildin_op(e, v, "*");
+  FORLESS(g->c->nlocals)
+  {
+    if (g->c->locals[i] == sym)
+      return i;
+  }
+  return -1;
 }
-lval *buildin_div(lenv *e, lval *v)
+void ljit_expr(ljitgen *g, lval *x, int tail);
+void ljit_call_expr(ljitgen *g, lval **xs, int n, int tail);
+// qexpr 当作代码运行 (body, if 的分支): 一个元素时就是这个元素的值
+void ljit_block(ljitgen *g, lval *v, int tail)
 {
-  return buildin_op(e, v, "/");
+  if (v->count == 1)
+    ljit_expr(g, v->cell[0], tail);
+  else if (v->count > 1)
+    ljit_call_expr(g, v->cell, v->count, tail);
+  else
+    g->ok = 0;
 }
-lval *buildin_var(lenv *e, lval *v, char *op)
+void ljit_expr(ljitgen *g, lval *x, int tail)
 {
-  LASSERT_TYPE("def", v, 0, LVAL_QEXPR);
-  lval *syms = v->cell[0];
-  LASSERT(v, syms->count == v->count - 1, "Function '%s' passed invalid argument!"
-                                          "params count %i, argument count %i",
-          "def", syms->count, (v->count - 1));
-  FORLESS(syms->count)
+  if (LVAL_IS_INT(x))
   {
-    if (strcmp(op, "def") == 0)
+    LJIT_EMIT(g, 0x48, 0xb8); // mov rax, imm64
+    ljit_u64(g, LVAL_NUMV(x));
+    return;
+  }
+  if (LVAL_IS_IMM(x)) // 浮点数
+  {
+    g->ok = 0;
+    return;
+  }
+  if (x->type == LVAL_SYM)
+  {
+    int i = ljit_local(g, x->sym);
+    if (i < 0)
     {
-      lenv_def(e, syms->cell[i], v->cell[i + 1]);
+      g->ok = 0;
+      return;
+    }
+    LJIT_EMIT(g, 0x48, 0x8b, 0x45, (char)(-8 * (i + 1))); // mov rax, [rbp - 8(i+1)]
+    return;
+  }
+  if (x->type == LVAL_SEXPR)
+    ljit_block(g, x, tail);
+  else
+    g->ok = 0;
+}
+void ljit_call_expr(ljitgen *g, lval **xs, int n, int tail)
+{
+  if (LVAL_TYPE(xs[0]) != LVAL_SYM || ljit_local(g, xs[0]->sym) >= 0 || lenv_root == NULL)
+  {
+    g->ok = 0;
+    return;
+  }
+  int sym = xs[0]->sym;
+  int k = lenv_find(lenv_root, sym);
+  lval *f = k >= 0 ? lenv_root->vals[k] : NULL;
+  if (f == NULL || LVAL_TYPE(f) != LVAL_FUN)
+  {
+    g->ok = 0;
+    return;
+  }
+  if (f->buildin == buildin_if && n == 4 && LVAL_TYPE(xs[2]) == LVAL_QEXPR && LVAL_TYPE(xs[3]) == LVAL_QEXPR)
+  {
+    ljit_use(g, sym, buildin_if);
+    g->j->cost++;
+    ljit_expr(g, xs[1], 0);
+    LJIT_EMIT(g, 0x48, 0x83, 0xf8, 0x01, 0x0f, 0x8c); // cmp rax, 1; jl else
+    int to_else = g->len;
+    ljit_u32(g, 0);
+    ljit_block(g, xs[2], tail);
+    LJIT_EMIT(g, 0xe9); // jmp end
+    int to_end = g->len;
+    ljit_u32(g, 0);
+    ljit_patch(g, to_else, g->len);
+    ljit_block(g, xs[3], tail);
+    ljit_patch(g, to_end, g->len);
+    return;
+  }
+  if (f->buildin && f->binop && n == 3)
+  {
+    if (!ljit_use(g, sym, f->buildin))
+    {
+      g->ok = 0;
+      return;
+    }
+    // 和解释器一样先算第一个参数
+    ljit_expr(g, xs[1], 0);
+    LJIT_EMIT(g, 0x50); // push rax
+    ljit_expr(g, xs[2], 0);
+    LJIT_EMIT(g, 0x48, 0x89, 0xc1, 0x58); // mov rcx, rax; pop rax
+    lbuildin b = f->buildin;
+    if (b == buildin_add)
+      LJIT_EMIT(g, 0x48, 0x01, 0xc8); // add rax, rcx
+    else if (b == buildin_sub)
+      LJIT_EMIT(g, 0x48, 0x29, 0xc8); // sub rax, rcx
+    else if (b == buildin_mul)
+    {
+      LJIT_EMIT(g, 0x48, 0x0f, 0xaf, 0xc1); // imul rax, rcx
+      ljit_fail_jump(g, LJIT_JO);
+    }
+    else if (b == buildin_div)
+    {
+      LJIT_EMIT(g, 0x48, 0x85, 0xc9); // test rcx, rcx
+      ljit_fail_jump(g, LJIT_JE);
+      LJIT_EMIT(g, 0x48, 0x99, 0x48, 0xf7, 0xf9); // cqo; idiv rcx
     }
     else
     {
-      lenv_put(e, syms->cell[i], v->cell[i + 1]);
+      char cc = b == buildin_gt ? 0x9f : b == buildin_ge ? 0x9d : b == buildin_lt ? 0x9c : b == buildin_le ? 0x9e : b == buildin_eq ? 0x94 : b == buildin_ne ? 0x95 : 0;
+      if (cc == 0)
+      {
+        g->ok = 0;
+        return;
+      }
+      LJIT_EMIT(g, 0x48, 0x39, 0xc8, 0x0f, cc, 0xc0, 0x48, 0x0f, 0xb6, 0xc0); // cmp rax, rcx; setcc al; movzx rax, al
+      return;
     }
+    ljit_check_imm(g);
+    return;
   }
-  return lval_sexpr();
-}
-lval *buildin_def(lenv *e, lval *v)
-{
-  return buildin_var(e, v, "def");
+  // 调用自己: 参数个数正好等于形参个数
+  if (!f->buildin && n - 1 == g->c->nlocals && ljit_resolves(sym, NULL, g->c) && ljit_use(g, sym, NULL))
+  {
+    for (int i = 1; i < n; i++)
+    {
+      ljit_expr(g, xs[i], 0);
+      LJIT_EMIT(g, 0x50); // push rax
+    }
+    if (tail)
+    {
+      for (int i = n - 2; i >= 0; i--)
+        LJIT_EMIT(g, 0x58, 0x48, 0x89, 0x45, (char)(-8 * (i + 1))); // pop rax; mov [rbp - 8(i+1)], rax
+      LJIT_EMIT(g, 0xe9);
+      ljit_u32(g, g->body - (g->len + 4));
+      return;
+    }
+    static const char pops[LJIT_ARGS][2] = {{0x5f}, {0x5e}, {0x5a}, {0x59}, {0x41, 0x58}, {0x41, 0x59}};
+    for (int i = n - 2; i >= 0; i--)
+      ljit_bytes(g, pops[i], i < 4 ? 1 : 2);
+    LJIT_EMIT(g, 0xe8); // call 自己
+    ljit_u32(g, 0 - (g->len + 4));
+    LJIT_EMIT(g, 0x48, 0xb9); // mov rcx, LJIT_FAIL; cmp rax, rcx; je fail
+    ljit_u64(g, LJIT_FAIL);
+    LJIT_EMIT(g, 0x48, 0x39, 0xc8);
+    ljit_fail_jump(g, LJIT_JE);
+    return;
+  }
+  g->ok = 0;
 }
-lval *buildin_put(lenv *e, lval *v)
+ljit *ljit_compile(lval *f, lcode *c)
 {
-  return buildin_var(e, v, "put");
+  if (c->nlocals == 0 || c->nlocals > LJIT_ARGS || f->formals->count != c->nlocals || f->env)
+    return NULL;
+  ljitgen g = {0};
+  g.c = c;
+  g.j = calloc(1, sizeof(ljit));
+  g.j->cost = 1;
+  g.ok = 1;
+  int frame = (8 * c->nlocals + 15) & ~15;
+  LJIT_EMIT(&g, 0x55, 0x48, 0x89, 0xe5); // push rbp; mov rbp, rsp
+  LJIT_EMIT(&g, 0x48, 0x81, 0xec);       // sub rsp, frame
+  ljit_u32(&g, frame);
+  LJIT_EMIT(&g, 0x48, 0xb8); // mov rax, &ljit_stack_limit; cmp rsp, [rax]; jb fail
+  ljit_u64(&g, (int64_t)(intptr_t)&ljit_stack_limit);
+  LJIT_EMIT(&g, 0x48, 0x3b, 0x20);
+  ljit_fail_jump(&g, LJIT_JB);
+  LJIT_EMIT(&g, 0x48, 0xb8); // mov rax, &ljit_depth; sub qword [rax], 1; jl fail
+  ljit_u64(&g, (int64_t)(intptr_t)&ljit_depth);
+  LJIT_EMIT(&g, 0x48, 0x83, 0x28, 0x01);
+  ljit_fail_jump(&g, LJIT_JL);
+  static const char saves[LJIT_ARGS][2] = {{0x48, 0x7d}, {0x48, 0x75}, {0x48, 0x55}, {0x48, 0x4d}, {0x4c, 0x45}, {0x4c, 0x4d}};
+  FORLESS(c->nlocals)
+  {
+    LJIT_EMIT(&g, saves[i][0], 0x89, saves[i][1], (char)(-8 * (i + 1))); // mov [rbp - 8(i+1)], 参数寄存器
+  }
+  g.body = g.len;
+  ljit_block(&g, f->body, 1);
+  LJIT_EMIT(&g, 0x48, 0xb9); // mov rcx, &ljit_depth; add qword [rcx], 1; leave; ret
+  ljit_u64(&g, (int64_t)(intptr_t)&ljit_depth);
+  LJIT_EMIT(&g, 0x48, 0x83, 0x01, 0x01);
+  LJIT_EMIT(&g, 0xc9, 0xc3);
+  int fail = g.len;
+  LJIT_EMIT(&g, 0x48, 0xb8); // mov rax, LJIT_FAIL; leave; ret
+  ljit_u64(&g, LJIT_FAIL);
+  LJIT_EMIT(&g, 0xc9, 0xc3);
+  FORLESS(g.nfails)
+  {
+    ljit_patch(&g, g.fails[i], fail);
+  }
+  ljit *j = g.j;
+  void *mem = MAP_FAILED;
+  if (g.ok)
+    mem = mmap(NULL, g.len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem != MAP_FAILED)
+  {
+    memcpy(mem, g.buf, g.len);
+    mprotect(mem, g.len, PROT_READ | PROT_EXEC);
+    j->fn = (ljitfn)mem;
+    j->size = g.len;
+    j->version = lenv_version;
+  }
+  else
+  {
+    free(j);
+    j = NULL;
+  }
+  free(g.buf);
+  free(g.fails);
+  return j;
 }
-
-lval *buildin_lambda(lenv *e, lval *v)
+#endif
+// f 是 lambda, args 是已经求值的参数. 能用机器码算就返回结果 (参数都是立即数, 不用释放),
+// 否则返回 NULL, 照常解释执行
+lval *ljit_call(lval *f, lval **args, int n)
 {
-  LASSERT_NUM("\\", v, 2);
-  LASSERT_TYPE("\\", v, 0, LVAL_QEXPR);
-  LASSERT_TYPE("\\", v, 1, LVAL_QEXPR);
-  lval *formals = lval_pop(v, 0);
-  lval *body = lval_pop(v, 0);
-  lval_del(v);
-  return lval_lambda(formals, body);
+#ifdef LJIT
+  lcode *c = f->body->code;
+  if (!ljit_enabled || c == NULL)
+    return NULL;
+  if (c->jit == NULL)
+  {
+    // 只尝试一次, 之后计数停在阈值上, 不会一直加到溢出
+    if (c->calls >= LJIT_THRESHOLD || ++c->calls != LJIT_THRESHOLD)
+      return NULL;
+    c->jit = ljit_compile(f, c);
+    if (c->jit == NULL)
+      return NULL;
+  }
+  if (n != c->nlocals || f->env || f->formals->count != n || !lcode_match(c, f->formals))
+    return NULL;
+  long a[LJIT_ARGS] = {0};
+  FORLESS(n)
+  {
+    if (!LVAL_IS_INT(args[i]))
+      return NULL;
+    a[i] = LVAL_NUMV(args[i]);
+  }
+  if (!ljit_guard(c->jit, c))
+    return NULL;
+  // 失败时解释器会重算, 所以这里只要保证机器码能算完的调用解释器也不会超过深度
+  ljit_depth = (lvm_max_depth - lvm_nframes) / c->jit->cost;
+  if (ljit_depth <= 0)
+    return NULL;
+  long r = c->jit->fn(a[0], a[1], a[2], a[3], a[4], a[5]);
+  if (r == LJIT_FAIL)
+  {
+    // 解释器重算时每一层调用都会再进来一次, 失败多了就放弃这份机器码
+    if (++c->jit->fails == LJIT_MAX_FAILS)
+    {
+      ljit_free(c->jit);
+      c->jit = NULL;
+    }
+    return NULL;
+  }
+  return LVAL_IMM(r);
+#else
+  return NULL;
+#endif
 }
-lval *buildin_ord(lenv *e, lval *v, char *op)
+lval *lcode_run(lenv *e, lcode *c, lval *src, int own);
+// 和 lval_expr_eval 对已经求值的元素做的事情一样, 接管 xs 里的引用
+lval *lvm_apply(lenv *e, lval **xs, int n)
 {
-  LASSERT_NUM(op, v, 2);
-  LASSERT_TYPE(op, v, 0, LVAL_NUM);
-  LASSERT_TYPE(op, v, 1, LVAL_NUM);
-  int res = 0;
-  if (strcmp(op, ">") == 0)
+  FORLESS(n)
+  {
+    if (LVAL_TYPE(xs[i]) == LVAL_ERR)
+    {
+      lval *err = xs[i];
+      for (int j = 0; j < n; j++)
+      {
+        if (j != i)
+          lval_del(xs[j]);
+      }
+      return err;
+    }
+  }
+  if (n == 0)
+    return lval_sexpr();
+  if (n == 1)
+    return xs[0];
+  lval *f = xs[0];
+  if (LVAL_TYPE(f) != LVAL_FUN && LVAL_TYPE(f) != LVAL_MEMO)
+  {
+    FORLESS(n)
+    {
+      lval_del(xs[i]);
+    }
+    return lval_err("S-Expression not start with Function!");
+  }
+  if (f->type == LVAL_FUN && f->buildin && f->binop && n == 3)
   {
-    res = v->cell[0]->num > v->cell[1]->num;
+    lval *res = f->binop(xs[1], xs[2]);
+    if (res)
+    {
+      lval_del(xs[1]);
+      lval_del(xs[2]);
+      lval_del(f);
+      return res;
+    }
   }
-  if (strcmp(op, ">=") == 0)
+  int lambda = f->type == LVAL_FUN && !f->buildin;
+  lval *r = lambda ? ljit_call(f, xs + 1, n - 1) : NULL;
+  if (r)
   {
-    res = v->cell[0]->num >= v->cell[1]->num;
+    lval_del(f);
+    return r;
   }
-  if (strcmp(op, "<") == 0)
+  lenv *env = lambda ? lvm_bind(f, xs + 1, n - 1) : NULL;
+  if (env)
   {
-    res = v->cell[0]->num < v->cell[1]->num;
+    // 不用拷贝 f 和形参, 直接在新环境里运行 body
+    env->pair = e;
+    lgc_write(env);
+    return lcode_run(env, lval_code(f->body, NULL), f, 1);
   }
-  if (strcmp(op, "<=") == 0)
+  lval *v = lval_sexpr();
+  lval_reserve(v, n - 1);
+  for (int i = 1; i < n; i++)
   {
-    res = v->cell[0]->num <= v->cell[1]->num;
+    lval_add(v, xs[i]);
   }
-  lval_del(v);
-  return lval_num(res);
-}
-lval *buildin_gt(lenv *e, lval *v)
-{
-  return buildin_ord(e, v, ">");
-}
-lval *buildin_ge(lenv *e, lval *v)
-{
-  return buildin_ord(e, v, ">=");
-}
-lval *buildin_lt(lenv *e, lval *v)
-{
-  return buildin_ord(e, v, "<");
+  lval *res = lval_call(e, v, f);
+  lval_del(f);
+  return res;
 }
-lval *buildin_le(lenv *e, lval *v)
+// 尾调用时调用者的环境 from 马上就没用了. 被调用者在自己的环境里找不到的变量,
+// 原本会接着在 from 里找, 所以把 from 里没被遮住的绑定并过来, 再接到 from 的父环境上
+// 查找结果不变, 环境链也不会随着循环次数变长
+void lenv_absorb(lenv *to, lenv *from)
 {
-  return buildin_ord(e, v, "<=");
+  FORLESS(from->count)
+  {
+    if (!(to->mask & LENV_BIT(from->syms[i])) || lenv_find(to, from->syms[i]) < 0)
+      lenv_bind(to, from->syms[i], from->vals[i]);
+  }
+  to->pair = from->pair;
 }
-int lval_compare(lval *x, lval *y)
+// 没有别的环境绑定 sym 时, 从哪个环境开始找结果都是全局环境里的那个,
+// 找到了就记进缓存; 全局环境的值被替换 (def / =) 或者有环境绑定了 sym 之后缓存失效
+lval *lvm_lookup(lenv *e, int sym, lcache *ic)
 {
-  if (x->type != y->type)
-    return 0;
-  switch (x->type)
+  if (lsyms[sym].shadow == 0)
   {
-  case LVAL_NUM:
-    return x->num == y->num;
-  case LVAL_SYM:
-    return strcmp(x->sym, y->sym) == 0;
-  case LVAL_ERR:
-    return strcmp(x->err, y->err) == 0;
-  case LVAL_STR:
-    return strcmp(x->str, y->str) == 0;
-  case LVAL_FUN:
-    if (x->buildin)
-      return x->buildin == y->buildin;
-    return lval_compare(x->formals, y->formals) && lval_compare(x->body, y->body);
-  case LVAL_SEXPR:
-  case LVAL_QEXPR:
-    if (x->count != y->count)
-      return 0;
-    FORLESS(x->count)
+    int i = lenv_find(lenv_root, sym);
+    if (i >= 0)
     {
-      if (lval_compare(x->cell[i], y->cell[i]) == 0)
-        return 0;
+      ic->version = lenv_version;
+      ic->val = lenv_root->vals[i];
+      return lval_ref(ic->val);
     }
-    return 1;
   }
-  return 1;
+  return lenv_lookup(e, sym);
 }
-lval *buildin_com(lenv *e, lval *v, char *op)
+// xs 是 if / eval 的调用, 参数也合适时, 返回接下来要在当前环境里运行的表达式,
+// 用不到的参数顺便释放 (xs[0] 除外); 否则返回 NULL, 什么都不动
+lval *lvm_branch(lval **xs, int n)
 {
-  LASSERT_NUM(op, v, 2);
-
-  lval *a = lval_pop(v, 0);
-  lval *b = lval_pop(v, 0);
-  int x = 0;
-  if (strcmp(op, "==") == 0)
-  {
-    x = lval_compare(a, b);
-  }
-  else
+  lval *f = xs[0];
+  if (f->buildin == buildin_if && n == 4 && LVAL_TYPE(xs[1]) == LVAL_NUM &&
+      LVAL_TYPE(xs[2]) == LVAL_QEXPR && LVAL_TYPE(xs[3]) == LVAL_QEXPR)
   {
-    x = !lval_compare(a, b);
+    int yes = LVAL_NUMV(xs[1]) >= 1;
+    lval_del(xs[yes ? 3 : 2]);
+    lval_del(xs[1]);
+    return xs[yes ? 2 : 3];
   }
-  lval_del(v);
-  return lval_num(x);
+  if (f->buildin == buildin_eval && n == 2 && LVAL_TYPE(xs[1]) == LVAL_QEXPR)
+    return xs[1];
+  return NULL;
 }
-lval *buildin_eq(lenv *e, lval *v)
-{
-  return buildin_com(e, v, "==");
-}
-lval *buildin_ne(lenv *e, lval *v)
+int lvm_has_err(lval **xs, int n)
 {
-  return buildin_com(e, v, "!=");
+  FORLESS(n)
+  {
+    if (LVAL_TYPE(xs[i]) == LVAL_ERR)
+      return 1;
+  }
+  return 0;
 }
-lval *buildin_if(lenv *e, lval *v)
+#if defined(__GNUC__) && !defined(LVM_NO_GOTO)
+#define LVM_GOTO // 用 computed goto 分派
+#endif
+// 运行字节码. src 是 c 的来源 (持有它才能保证常量活着), own 表示 e 是这次调用自己建的;
+// 两者都在结束时释放. 尾位置上的 lambda 调用, if 和 eval 不再递归,
+// 而是在这里换成新的 c / e / src 继续跑, 所以尾递归只占固定的 C 栈;
+// 其他位置上的先把当前状态压进 lvm_frames 再换, RET 时取回来, 也不占 C 栈
+lval *lcode_run(lenv *e, lcode *c, lval *src, int own)
 {
-  LASSERT_NUM("if", v, 3);
-  LASSERT_TYPE("if", v, 0, LVAL_NUM);
-  LASSERT_TYPE("if", v, 1, LVAL_QEXPR);
-  LASSERT_TYPE("if", v, 2, LVAL_QEXPR);
-  v->cell[1]->type = LVAL_SEXPR;
-  v->cell[2]->type = LVAL_SEXPR;
-  lval *x;
-  if (v->cell[0]->num >= 1)
+  if (lvm_stack == NULL)
+    lvm_stack = malloc(sizeof(lval *) * LVM_STACK_MAX);
+  int frames = lvm_nframes; // 这次调用压进去的帧在它上面
+  int base = lvm_sp;
+  if (lval_deep())
   {
-    // lval_eval 是直接执行语句
-    // buildin_eval 支持完整program, 所以其子对象必须是Q-Expression
-    // 所以这里直接把 元素从v 中pop出来成为独立对象(其在执行时被释放)
-    x = lval_eval(e, lval_pop(v, 1));
+    lval_del(src);
+    if (own)
+      lenv_del(e);
+    return lval_err("Stack overflow!");
   }
-  else
+  lval **stack = lvm_stack + base;
+  int sp;
+  int *pc;
+  int arg;
+  lval *res;
+  // 运行期间 body 可能被别的 lambda 按另一组形参重新编译
+  c->rc++;
+#ifdef LVM_GOTO
+  static void *labels[] = {&&L_LOP_CONST, &&L_LOP_LOOKUP, &&L_LOP_LOCAL, &&L_LOP_CALL, &&L_LOP_TAIL, &&L_LOP_RET, &&L_LOP_FOLD};
+#define LVM_OP(op) L_##op:
+#define LVM_NEXT() goto *labels[*pc++]
+#else
+#define LVM_OP(op) case op:
+#define LVM_NEXT() continue
+#endif
+enter:
+  if (base + c->depth > LVM_STACK_MAX)
   {
-    x = lval_eval(e, lval_pop(v, 2));
+    res = lval_err("Stack overflow!");
+    goto ret;
   }
-  lval_del(v);
-  return x;
-}
-// load "lispy.lsp"
-lval *buildin_load(lenv *e, lval *v)
-{
-  LASSERT_NUM("load", v, 1);
-  LASSERT_TYPE("load", v, 0, LVAL_STR);
-  mpc_result_t r;
-  if (mpc_parse_contents(v->cell[0]->str, Lispy, &r))
+  lvm_sp = base + c->depth;
+  sp = 0;
+  pc = c->ops;
+#ifdef LVM_GOTO
+  LVM_NEXT();
+#else
+  for (;;)
   {
-    lval *expr = lval_read(r.output);
-    mpc_ast_delete(r.output);
-    int i = 0;
-    // 逐个运行
-    while (expr->count)
+    switch (*pc++)
     {
-      lval *x = lval_eval(e, lval_pop(expr, 0));
-      if (x->type == LVAL_ERR)
-      {
-        lval_println(x);
-      }
-      lval_del(x);
-      i++;
-    }
-    lval_del(expr);
-    lval_del(v);
-
-    return lval_sexpr();
+#endif
+  LVM_OP(LOP_CONST)
+  {
+    arg = *pc++;
+    stack[sp++] = lval_ref(c->consts[arg]);
+    LVM_NEXT();
   }
-  else
+  LVM_OP(LOP_LOOKUP)
   {
-    lval_del(v);
-    char *err_msg = mpc_err_string(r.error);
-    mpc_err_delete(r.error);
-
-    lval *err = lval_err(err_msg);
-    free(err_msg);
-
-    return err;
+    arg = *pc++;
+    lcache *ic = &c->caches[*pc++];
+    if (ic->version == lenv_version && lsyms[arg].shadow == 0)
+      stack[sp++] = lval_ref(ic->val);
+    else
+      stack[sp++] = lvm_lookup(e, arg, ic);
+    LVM_NEXT();
   }
-}
-lval *buildin_print(lenv *e, lval *v)
-{
-  FORLESS(v->count)
+  LVM_OP(LOP_LOCAL)
   {
-    lval_print(v->cell[i]);
-    putchar(' ');
+    // 只要当前环境的这个槽位确实是这个符号, 就和按名字查找的结果一样
+    arg = *pc++;
+    int slot = *pc++;
+    if (slot < e->count && e->syms[slot] == arg)
+      stack[sp++] = lval_ref(e->vals[slot]);
+    else
+      stack[sp++] = lenv_lookup(e, arg);
+    LVM_NEXT();
   }
-  putchar('\n');
-  lval_del(v);
-  return lval_sexpr();
-}
-lval *lval_call(lenv *e, lval *v, lval *f)
-{
-  if (f->buildin)
-    return f->buildin(e, v);
-
-  int count = v->count;
-  int total = f->formals->count;
-  while (v->count)
+  LVM_OP(LOP_CALL)
   {
-    if (f->formals->count == 0)
-    {
-      lval_del(v);
-      return lval_err("Function '%s' passedd too many argument!"
-                      "Got %i, Expect %i",
-                      "call", count, total);
-    }
-    // 此处将fun中的形参拿出，同时将参数对应上
-    // 然后保存到f->env 环境变量中
-    lval *sym = lval_pop(f->formals, 0);
-    // def { addCurry } (\ { x y & last } { eval (join (list + x y) (head last) ) })
-    // addCurry 10 20 40 30 -> 10 + 20 + 40 = 70
-    if (strcmp(sym->sym, "&") == 0)
+    arg = *pc++;
+    sp -= arg;
+    lval **xs = &stack[sp];
+    lval *f = xs[0];
+    lenv *env = NULL;
+    lval *next = NULL;
+    if (arg >= 2 && LVAL_TYPE(f) == LVAL_FUN && (!f->buildin || f->buildin == buildin_if || f->buildin == buildin_eval) &&
+        !lvm_has_err(xs, arg))
     {
-      if (f->formals->count != 1)
+      if (!f->buildin)
       {
-        lval_del(sym);
-        lval_del(v);
-        return lval_err("Function '%s' pass invalid format argument!"
-                        "Symbol '&' must followed by only one symbol!"
-                        "Got %i, Expect %i",
-                        "call", f->formals->count, 1);
+        lval *r = ljit_call(f, xs + 1, arg - 1);
+        if (r)
+        {
+          lval_del(f);
+          stack[sp++] = r;
+          LVM_NEXT();
+        }
+        env = lvm_bind(f, xs + 1, arg - 1);
       }
-      lval *syms = lval_pop(f->formals, 0);
-      lval *vals = buildin_list(f->env, v);
-      lenv_put(f->env, syms, vals);
-      lval_del(sym);
-      lval_del(syms);
-      break;
+      else
+        next = lvm_branch(xs, arg);
     }
-    lval *val = lval_pop(v, 0);
-    lenv_put(f->env, sym, val);
-    lval_del(sym);
-    lval_del(val);
-  }
-  lval_del(v);
-  // 这里的作用，是在上面执行后，仍然还有 `& x`
-  // 其实参数已经写完，只剩复数参数，那么直接给其复制空参数即可执行了
-  if (f->formals->count != 0 && strcmp(f->formals->cell[0]->sym, "&") == 0)
-  {
-    if (f->formals->count != 2)
+    if (env == NULL && next == NULL)
     {
-      return lval_err("Function '%s' pass invalid format argument!"
-                      "Symbol '&' must followed by only one symbol!"
-                      "Got %i, Expect %i",
-                      "call", f->formals->count, 1);
+      stack[sp] = lvm_apply(e, xs, arg);
+      sp++;
+      LVM_NEXT();
     }
-    lval_del(lval_pop(f->formals, 0));
-    lval *syms = lval_pop(f->formals, 0);
-    lval *vals = lval_qexpr(); // 空参数
-    lenv_put(f->env, syms, vals);
-    lval_del(syms);
-    lval_del(vals);
-  }
-  // 说明参数全，开始运行
-  if (f->formals->count == 0)
-  {
-    // 为当前fun的局部环境变量增加父级环境变量
-    f->env->pair = e;
-    // 执行时，将环境变量传入，相当于提前有了相关的环境变量
-    // 执行语句是body，拷贝一份给 buildin_eval 去执行
-    return buildin_eval(f->env, lval_add(lval_qexpr(), lval_copy(f->body)));
+    if (lvm_nframes >= lvm_max_depth)
+    {
+      if (env)
+        lenv_del(env);
+      else
+        lval_del(next);
+      lval_del(f);
+      stack[sp++] = lval_err("Maximum recursion depth %i exceeded!", lvm_max_depth);
+      LVM_NEXT();
+    }
+    // 保存调用者, 被调用者的栈接在调用者已用部分的后面
+    if (lvm_nframes == lvm_frames_cap)
+    {
+      lvm_frames_cap = lvm_frames_cap ? lvm_frames_cap * 2 : 64;
+      lvm_frames = realloc(lvm_frames, sizeof(lframe) * lvm_frames_cap);
+    }
+    lvm_frames[lvm_nframes++] = (lframe){c, e, src, own, pc, base, sp};
+    base += sp;
+    stack = lvm_stack + base;
+    if (env)
+    {
+      env->pair = e;
+      lgc_write(env);
+      e = env;
+      own = 1;
+      src = f;
+      c = lval_code(f->body, NULL);
+    }
+    else
+    {
+      lval_del(f);
+      own = 0;
+      src = next;
+      c = lval_code(next, NULL);
+    }
+    c->rc++;
+    goto enter;
   }
-  else
+  LVM_OP(LOP_TAIL)
   {
-    return lval_copy(f);
+    arg = *pc++;
+    sp -= arg;
+    lval **xs = &stack[sp];
+    lval *f = xs[0];
+    lval *next = NULL; // 接下来要运行的表达式
+    if (arg >= 2 && LVAL_TYPE(f) == LVAL_FUN)
+    {
+      if (lvm_has_err(xs, arg))
+        goto call;
+      if (!f->buildin)
+      {
+        lval *r = ljit_call(f, xs + 1, arg - 1);
+        if (r)
+        {
+          lval_del(f);
+          stack[sp++] = r;
+          LVM_NEXT();
+        }
+        lenv *env = lvm_bind(f, xs + 1, arg - 1);
+        if (env == NULL)
+          goto call;
+        if (own)
+        {
+          lenv_absorb(env, e);
+          lenv_del(e);
+        }
+        else
+          env->pair = e;
+        lgc_write(env);
+        e = env;
+        own = 1;
+        lval_del(src);
+        src = f;
+        lcode_release(c);
+        c = lval_code(f->body, NULL);
+        c->rc++;
+        goto enter;
+      }
+      next = lvm_branch(xs, arg);
+      if (next)
+      {
+        // 在同一个环境里接着运行选中的表达式
+        lval_del(f);
+        lval_del(src);
+        src = next;
+        lcode_release(c);
+        c = lval_code(next, NULL);
+        c->rc++;
+        goto enter;
+      }
+    }
+  call:
+    stack[sp] = lvm_apply(e, xs, arg);
+    sp++;
+    LVM_NEXT();
   }
-}
-lval *lval_expr_eval(lenv *e, lval *v)
-{
-  FORLESS(v->count)
+  LVM_OP(LOP_RET)
   {
-    v->cell[i] = lval_eval(e, v->cell[i]);
+    res = stack[sp - 1];
+  ret:
+    if (lvm_nframes == frames)
+      goto done;
+    // 回到调用者, 结果压到它的栈上
+    lcode_release(c);
+    if (own)
+      lenv_del(e);
+    lval_del(src);
+    lframe *fr = &lvm_frames[--lvm_nframes];
+    c = fr->c;
+    e = fr->e;
+    src = fr->src;
+    own = fr->own;
+    pc = fr->pc;
+    base = fr->base;
+    sp = fr->sp;
+    stack = lvm_stack + base;
+    lvm_sp = base + c->depth;
+    stack[sp++] = res;
+    LVM_NEXT();
   }
-  FORLESS(v->count)
+  LVM_OP(LOP_FOLD)
   {
-    if (v->cell[i]->type == LVAL_ERR)
+    // FOLD k skip n sym...: 用到的内建函数都没变就直接用常量, 跳过原来的代码
+    arg = *pc++;
+    int skip = *pc++;
+    int n = *pc++;
+    int ok = c->fold_version == lenv_fold_version;
+    FORLESS(n)
     {
-      return lval_take(v, i);
+      ok = ok && lsyms[pc[i]].shadow == 0;
+    }
+    pc += n;
+    if (ok)
+    {
+      stack[sp++] = c->consts[arg];
+      pc += skip;
     }
+    LVM_NEXT();
   }
-  if (v->count == 0)
-    return v;
-  if (v->count == 1)
-    return lval_take(v, 0);
-
-  lval *f = lval_pop(v, 0);
-  if (f->type != LVAL_FUN)
-  {
-    lval_del(f);
-    lval_del(v);
-    return lval_err("S-Expression not start with Function!");
+#ifndef LVM_GOTO
+    }
   }
-  lval *res = lval_call(e, v, f);
-  //    lval* res = f->fun(e, v);
-  //    lval* res = buildin(v, f->sym);
-  //    lval* res = buildin_op(v, f->sym);
-  lval_del(f);
+#endif
+#undef LVM_OP
+#undef LVM_NEXT
+done:
+  lvm_sp = base;
+  lcode_release(c);
+  if (own)
+    lenv_del(e);
+  lval_del(src);
   return res;
 }
+// 编译 (如果还没有) 并运行 S-Expression v
+lval *lval_run(lenv *e, lval *v)
+{
+  return lcode_run(e, lval_code(v, NULL), v, 0);
+}
 lval *lval_eval(lenv *e, lval *v)
 {
+  if (LVAL_IS_IMM(v))
+    return v;
   if (v->type == LVAL_SYM)
   {
     lval *x = lenv_get(e, v);
@@ -886,9 +5188,20 @@ lval *lval_eval(lenv *e, lval *v)
     return x;
   }
   if (v->type == LVAL_SEXPR)
+  {
+    if (lvm_enabled && v->code)
+      return lval_run(e, v);
     return lval_expr_eval(e, v);
+  }
   return v;
 }
+// 顶层语句总是编译
+lval *lval_eval_top(lenv *e, lval *v)
+{
+  if (lvm_enabled && LVAL_TYPE(v) == LVAL_SEXPR)
+    return lval_run(e, v);
+  return lval_eval(e, v);
+}
 void lenv_add_buildin(lenv *e, char *sym, lbuildin fun)
 {
   lval *symVal = lval_sym(sym);
@@ -897,6 +5210,16 @@ void lenv_add_buildin(lenv *e, char *sym, lbuildin fun)
   lval_del(symVal);
   lval_del(funVal);
 }
+// 带两个参数快速版本的内建函数
+void lenv_add_binop(lenv *e, char *sym, lbuildin fun, lbinop binop)
+{
+  lval *symVal = lval_sym(sym);
+  lval *funVal = lval_fun(fun);
+  funVal->binop = binop;
+  lenv_put(e, symVal, funVal);
+  lval_del(symVal);
+  lval_del(funVal);
+}
 void lenv_add_buildins(lenv *e)
 {
   lenv_add_buildin(e, "head", buildin_head);
@@ -909,24 +5232,95 @@ void lenv_add_buildins(lenv *e)
   lenv_add_buildin(e, "\\", buildin_lambda);
   lenv_add_buildin(e, "load", buildin_load);
   lenv_add_buildin(e, "print", buildin_print);
+  lenv_add_buildin(e, "gc-stats", buildin_gc_stats);
+  lenv_add_buildin(e, "memo", buildin_memo);
+  lenv_add_buildin(e, "memo-stats", buildin_memo_stats);
+  lenv_add_buildin(e, "vec", buildin_vec);
+  lenv_add_buildin(e, "vec-range", buildin_vec_range);
+  lenv_add_buildin(e, "vec-len", buildin_vec_len);
+  lenv_add_buildin(e, "vec-nth", buildin_vec_nth);
+  lenv_add_buildin(e, "vec-list", buildin_vec_list);
+  lenv_add_buildin(e, "vec-sum", buildin_vec_sum);
+  lenv_add_buildin(e, "vec-min", buildin_vec_min);
+  lenv_add_buildin(e, "vec-max", buildin_vec_max);
+  lenv_add_buildin(e, "vec-dot", buildin_vec_dot);
+  lenv_add_buildin(e, "mat", buildin_mat);
+  lenv_add_buildin(e, "mat-list", buildin_mat_list);
+  lenv_add_buildin(e, "mat-shape", buildin_mat_shape);
+  lenv_add_buildin(e, "mat-ref", buildin_mat_ref);
+  lenv_add_buildin(e, "mat-eye", buildin_mat_eye);
+  lenv_add_buildin(e, "mat-t", buildin_mat_t);
+  lenv_add_buildin(e, "mat-mul", buildin_mat_mul);
 
-  lenv_add_buildin(e, ">", buildin_gt);
-  lenv_add_buildin(e, ">=", buildin_ge);
-  lenv_add_buildin(e, "<", buildin_lt);
-  lenv_add_buildin(e, "<=", buildin_le);
-  lenv_add_buildin(e, "==", buildin_eq);
-  lenv_add_buildin(e, "!=", buildin_ne);
+  lenv_add_binop(e, ">", buildin_gt, lbin_gt);
+  lenv_add_binop(e, ">=", buildin_ge, lbin_ge);
+  lenv_add_binop(e, "<", buildin_lt, lbin_lt);
+  lenv_add_binop(e, "<=", buildin_le, lbin_le);
+  lenv_add_binop(e, "==", buildin_eq, lbin_eq);
+  lenv_add_binop(e, "!=", buildin_ne, lbin_ne);
   lenv_add_buildin(e, "if", buildin_if);
 
-  lenv_add_buildin(e, "+", buildin_add);
-  lenv_add_buildin(e, "-", buildin_sub);
-  lenv_add_buildin(e, "*", buildin_mul);
-  lenv_add_buildin(e, "/", buildin_div);
+  lenv_add_binop(e, "+", buildin_add, lbin_add);
+  lenv_add_binop(e, "-", buildin_sub, lbin_sub);
+  lenv_add_binop(e, "*", buildin_mul, lbin_mul);
+  lenv_add_binop(e, "/", buildin_div, lbin_div);
 }
 
 int main(int argc, char **argv)
 {
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--malloc") == 0)
+      lalloc_use_malloc = 1;
+    else if (strcmp(argv[i], "--trim") == 0)
+      lalloc_trim = 1;
+    else if (strcmp(argv[i], "--arena") == 0)
+      larena_enabled = 1;
+    else if (strcmp(argv[i], "--eval=tree") == 0)
+      lvm_enabled = 0;
+    else if (strcmp(argv[i], "--eval=vm") == 0)
+      lvm_enabled = 1;
+    else if (strcmp(argv[i], "--gc=rc") == 0)
+      lgc_mode = LGC_RC;
+    else if (strcmp(argv[i], "--gc=marksweep") == 0)
+      lgc_mode = LGC_MARKSWEEP;
+    else if (strcmp(argv[i], "--gc=gen") == 0)
+      lgc_mode = LGC_GEN;
+    else if (strncmp(argv[i], "--gc-growth=", 12) == 0)
+      lgc_growth = atof(argv[i] + 12);
+    else if (strncmp(argv[i], "--gc-nursery=", 13) == 0)
+      lgc_nursery = atol(argv[i] + 13);
+    else if (strncmp(argv[i], "--max-depth=", 12) == 0)
+      lvm_max_depth = atoi(argv[i] + 12);
+    else if (strcmp(argv[i], "--no-jit") == 0)
+      ljit_enabled = 0;
+    else if (strcmp(argv[i], "--no-simd") == 0)
+      lvec_simd = -1;
+    else if (strcmp(argv[i], "--reader=mpc") == 0)
+      lread_mpc = 1;
+    else if (strcmp(argv[i], "--reader=direct") == 0)
+      lread_mpc = 0;
+  }
+#ifdef LVEC_AVX2
+  lvec_simd = lvec_simd == 0 && __builtin_cpu_supports("avx2");
+#endif
+  if (lvec_simd < 0)
+    lvec_simd = 0;
+  lval_stack_base = __builtin_frame_address(0);
+  ljit_stack_limit = lval_stack_base - LVAL_C_STACK;
+  if (lalloc_use_malloc)
+    larena_enabled = 0; // 要靠 chunk 头区分 arena 里的对象
+  if (lgc_mode != LGC_RC)
+  {
+    // 回收器需要从内存池里找对象, 不能退回 malloc
+    lalloc_use_malloc = 0;
+    larena_enabled = 0;
+    lgc_stack_base = __builtin_frame_address(0);
+    if (lgc_growth < 1.1)
+      lgc_growth = 1.1;
+  }
   Number = mpc_new("number");
+  Double = mpc_new("double");
   Symbol = mpc_new("symbol");
   String = mpc_new("string");
   Comment = mpc_new("comment");
@@ -936,35 +5330,73 @@ int main(int argc, char **argv)
   Lispy = mpc_new("lispy");
   mpca_lang(MPCA_LANG_DEFAULT,
             "                                                     \
+      double : /-?[0-9]+(\\.[0-9]+([eE][-+]?[0-9]+)?|[eE][-+]?[0-9]+)/ ; \
       number : /-?[0-9]+/ ;                               \
       symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ;        \
       string : /\\\"(\\\\.|[^\"])*\"/ ;                   \
       comment : /;[^\\r\\n]*/ ;                           \
       sexpr  : '(' <expr>* ')' ;                          \
       qexpr  : '{' <expr>* '}' ;                          \
-      expr   : <number> | <symbol> | <string> | <comment> | <sexpr> | <qexpr> ;  \
+      expr   : <double> | <number> | <symbol> | <string> | <comment> | <sexpr> | <qexpr> ;  \
       lispy  : /^/ <expr>* /$/ ;                          \
     ",
-            Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
-  puts("Lispy Version 0.0.0.0.14");
-  puts("Press Ctrl+c to Exit\n");
-
+            Double, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+  lsym_amp = lsym_intern("&");
   lenv *e = lenv_new();
+  lenv_index(e); // 全局环境总是用哈希表
+  lenv_root = lgc_root_env = e;
   lenv_add_buildins(e);
 
-  while (1)
+  // lispy a.lsp b.lsp: 依次运行这些文件后退出, 不进 REPL
+  int files = 0;
+  for (int i = 1; i < argc; i++)
+  {
+    if (argv[i][0] == '-')
+      continue;
+    files++;
+    larena_on = larena_enabled;
+    lval *x = buildin_load(e, lval_add(lval_sexpr(), lval_str(argv[i])));
+    if (LVAL_TYPE(x) == LVAL_ERR)
+      lval_println(x);
+    lval_del(x);
+    larena_on = 0;
+  }
+  if (files == 0)
+  {
+    puts("Lispy Version 0.0.0.0.14");
+    puts("Press Ctrl+c to Exit\n");
+  }
+
+  while (files == 0)
   {
     char *input = readline("lispy> ");
+    if (input == NULL) // EOF
+      break;
     add_history(input);
 
     mpc_result_t r;
-    if (mpc_parse("<stdin>", input, Lispy, &r))
+    if (!lread_mpc)
+    {
+      larena_on = larena_enabled;
+      lval *res = lval_read_src("<stdin>", input);
+      lval *x = LVAL_TYPE(res) == LVAL_ERR ? res : lval_eval_top(e, res);
+      lval_println(x);
+      lval_del(x);
+      larena_on = 0;
+      if (lalloc_trim)
+        lalloc_trim_all();
+    }
+    else if (mpc_parse("<stdin>", input, Lispy, &r))
     {
+      larena_on = larena_enabled;
       lval *res = lval_read(r.output);
-      lval *x = lval_eval(e, res);
+      lval *x = lval_eval_top(e, res);
       lval_println(x);
       lval_del(x);
+      larena_on = 0;
       mpc_ast_delete(r.output);
+      if (lalloc_trim)
+        lalloc_trim_all();
     }
     else
     {
@@ -976,7 +5408,7 @@ int main(int argc, char **argv)
 
   lenv_del(e);
 
-  mpc_cleanup(8, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+  mpc_cleanup(9, Double, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
 
   return 0;
 }
@@ -994,15 +5426,46 @@ void lval_expr_print(lval *v, char open, char close)
   }
   putchar(close);
 }
+// 用能原样读回来的最短写法, 没有小数点时补上 ".0", 读回来还是浮点数
+void lval_print_dbl(double d)
+{
+  char buf[32];
+  for (int p = 15; p <= 17; p++)
+  {
+    snprintf(buf, sizeof(buf), "%.*g", p, d);
+    if (strtod(buf, NULL) == d)
+      break;
+  }
+  if (!strpbrk(buf, ".eni"))
+    strcat(buf, ".0");
+  printf("%s", buf);
+}
+void lvec_print(lvec *x, long i)
+{
+  if (x->kind == LVEC_DBL)
+    lval_print_dbl(x->d[i]);
+  else
+    printf("%li", x->i[i]);
+}
 void lval_print(lval *v)
 {
-  switch (v->type)
+  switch (LVAL_TYPE(v))
   {
   case LVAL_ERR:
     printf("%s", v->err);
     break;
   case LVAL_NUM:
-    printf("%i", v->num);
+    if (LVAL_IS_BIG(v))
+    {
+      char *s = lbig_str(v->big);
+      printf("%s", s);
+      free(s);
+    }
+    else
+      printf("%li", LVAL_NUMV(v));
+    break;
+  case LVAL_DBL:
+    lval_print_dbl(LVAL_DBLV(v));
     break;
   case LVAL_FUN:
   {
@@ -1020,11 +5483,40 @@ void lval_print(lval *v)
     }
   }
   break;
+  case LVAL_MEMO:
+    printf("(memo ");
+    lval_print(v->memo->fn);
+    putchar(')');
+    break;
+  case LVAL_VEC:
+    printf("(vec");
+    for (long i = 0; i < v->vec->n; i++)
+    {
+      putchar(' ');
+      lvec_print(v->vec, i);
+    }
+    putchar(')');
+    break;
+  case LVAL_MAT:
+    printf("(mat {");
+    for (long i = 0; i < v->vec->rows; i++)
+    {
+      printf(i ? " {" : "{");
+      for (long j = 0; j < v->vec->cols; j++)
+      {
+        if (j)
+          putchar(' ');
+        lvec_print(v->vec, i * v->vec->cols + j);
+      }
+      putchar('}');
+    }
+    printf("})");
+    break;
   case LVAL_SYM:
-    printf("%s", v->sym);
+    printf("%s", lsym_name(v->sym));
     break;
   case LVAL_STR:
-    printf("\"%s\"", v->str);
+    printf("\"%.*s\"", v->len, v->str);
     break;
   case LVAL_SEXPR:
     lval_expr_print(v, '(', ')');
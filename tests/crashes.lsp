@@ -0,0 +1,16 @@
+; 以前会崩溃的输入, 现在都应当只是报错
+
+; def / = 的名字不是符号
+(def {1} 2)
+(= {"s"} 2)
+
+; lambda 和内建函数比较, 以及作为 memo 的参数 (用到 lval_hash)
+(print (== (\ {x} {x}) +) (== + (\ {x} {x})) (== + +) (== + -))
+(def {mf} (memo (\ {f} {1})))
+(print (mf +) (mf (\ {x} {x})) (mf +))
+
+; '&' 后面没有符号
+(def {b1} (\ {a &} {a}))
+(b1 1)
+(def {b2} (\ {&} {1}))
+(b2 1 2)
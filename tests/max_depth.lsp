@@ -0,0 +1,10 @@
+; --max-depth 对 JIT 编译过的 lambda 也要生效
+;   ./lispy --max-depth=10 tests/max_depth.lsp
+; 和 --no-jit 一样, (deep 50) 应当报 "Maximum recursion depth 10 exceeded!"
+(def {deep} (\ {n} {if (== n 0) {0} {+ 1 (deep (- n 1))}}))
+
+; 调用次数超过 LJIT_THRESHOLD, 让 deep 被编译. 尾调用不占帧, 不受 --max-depth 限制
+(def {warm} (\ {k} {if (== k 0) {0} {warm (- k 1 (deep 2))}}))
+(warm 150)
+
+(deep 50)
@@ -0,0 +1,37 @@
+; 各种 --gc / --eval / --reader / --arena 组合下输出都应当一样, 见 CMakeLists.txt
+(load "lispy.lsp")
+
+; 整数溢出时转成大数
+(print (* 9223372036854775807 9223372036854775807))
+(print (- -9223372036854775807 10))
+(print (/ (* 123456789012345678901234567890 1000) 1000))
+(print (== 18446744073709551616 (* 4294967296 4294967296)))
+
+; double
+(print (+ 0.1 0.2) (/ 1 2.0) (- 0.0) (== 1 1.0))
+
+; 字符串, 列表, lambda
+(print "a\"b" {1 {2 "x"} sym} (join {1} {2 3}))
+(fun {fib n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}})
+(print (fib 20))
+(print (map (\ {x} {* x x}) {1 2 3 4}))
+(print (foldl + 0 (vec-list (vec-range 200))))
+
+; 尾递归
+(fun {count n acc} {if (== n 0) {acc} {count (- n 1) (+ acc 1)}})
+(print (count 5000 0))
+
+; 分配很多短命对象, 让回收器跑起来
+(fun {churn n acc} {if (== n 0) {acc} {churn (- n 1) (join (list n n) acc)}})
+(print (fst (churn 5000 {})))
+
+; memo
+(def {mfib} (memo (\ {n} {if (< n 2) {n} {+ (mfib (- n 1)) (mfib (- n 2))}})))
+(print (mfib 90))
+
+; 向量和矩阵
+(print (+ (vec 1 2 3) 10) (vec-sum (vec-range 1000)) (vec-dot (vec 1 2) (vec 3 4)))
+(print (mat-mul (mat {{1 2} {3 4}}) (mat-t (mat {{1 2} {3 4}}))))
+
+; 读取器
+(print {1-2 12abc 1.5e -x 3E2 "t;x"})
@@ -0,0 +1,15 @@
+#!/bin/sh
+# 用法: run.sh lispy name [参数...]
+# 运行 tests/name.lsp, 进程要正常退出, 输出要和 tests/name.out 一样
+lispy=$1
+name=$2
+shift 2
+dir=$(dirname "$0")
+out=$("$lispy" "$@" "$dir/$name.lsp")
+status=$?
+if [ $status -ne 0 ]; then
+  printf '%s\n' "$out"
+  echo "$name: exit status $status"
+  exit 1
+fi
+printf '%s\n' "$out" | diff "$dir/$name.out" -